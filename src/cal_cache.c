@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "defs.h"
+#include "cpld.h"
+#include "logging.h"
+#include "filesystem.h"
+#include "cal_cache.h"
+
+// Each line of the file is one entry:
+// profile,sub_profile,mode7,line_time_ns,lines_per_frame,clock,param=value,param=value...
+// where param is the property name of the CPLD parameter (as in the saved
+// profiles), so entries stay valid if the parameter keys are renumbered
+
+#define CAL_CACHE_NAME_WIDTH 32
+
+typedef struct {
+   cal_cache_key_t key;
+   int nparams;
+   char params[CAL_CACHE_MAX_PARAMS][CAL_CACHE_NAME_WIDTH];
+   int values[CAL_CACHE_MAX_PARAMS];
+} cal_cache_entry_t;
+
+static cal_cache_entry_t entries[CAL_CACHE_MAX_ENTRIES];
+static int num_entries = 0;
+
+// The CPLD design the entries were loaded for
+static cpld_t *loaded_cpld = NULL;
+
+static char buffer[CAL_CACHE_BUFFER_SIZE];
+
+// The values the last cal_cache_apply replaced, for cal_cache_undo
+static int undo_params[CAL_CACHE_MAX_PARAMS];
+static int undo_values[CAL_CACHE_MAX_PARAMS];
+static int num_undo = 0;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+static int key_matches(cal_cache_key_t *a, cal_cache_key_t *b) {
+   int tolerance = (int) ((double) a->line_time_ns * CAL_CACHE_LINE_TOLERANCE / 1000000);
+   return strcmp(a->profile, b->profile) == 0 && strcmp(a->sub_profile, b->sub_profile) == 0
+          && a->mode7 == b->mode7 && abs(a->line_time_ns - b->line_time_ns) <= tolerance
+          && a->lines_per_frame == b->lines_per_frame && a->clock == b->clock;
+}
+
+// Returns the key of the CPLD parameter with the given property name, or -1
+static int find_param(const char *name) {
+   param_t *params = cpld->get_params();
+   for (int i = 0; params[i].key >= 0; i++) {
+      if (strcmp(params[i].property_name, name) == 0) {
+         return params[i].key;
+      }
+   }
+   return -1;
+}
+
+static cal_cache_entry_t *find_entry(cal_cache_key_t *key) {
+   for (int i = 0; i < num_entries; i++) {
+      if (key_matches(&entries[i].key, key)) {
+         return &entries[i];
+      }
+   }
+   return NULL;
+}
+
+// Copies the next comma separated field of *line into field
+static int next_field(char **line, char *field, int size) {
+   char *end = strchr(*line, ',');
+   int len = end ? end - *line : strlen(*line);
+   if (len >= size) {
+      return 0;
+   }
+   strncpy(field, *line, len);
+   field[len] = 0;
+   *line += end ? len + 1 : len;
+   return 1;
+}
+
+static int parse_entry(char *line, cal_cache_entry_t *entry) {
+   char field[MAX_PROFILE_WIDTH];
+   cal_cache_key_t *key = &entry->key;
+   if (!next_field(&line, key->profile, sizeof(key->profile)) || !next_field(&line, key->sub_profile, sizeof(key->sub_profile))) {
+      return 0;
+   }
+   if (sscanf(line, "%d,%d,%d,%d", &key->mode7, &key->line_time_ns, &key->lines_per_frame, &key->clock) != 4) {
+      return 0;
+   }
+   for (int i = 0; i < 4; i++) {
+      next_field(&line, field, sizeof(field));
+   }
+   entry->nparams = 0;
+   while (*line && entry->nparams < CAL_CACHE_MAX_PARAMS) {
+      if (!next_field(&line, field, sizeof(field))) {
+         return 0;
+      }
+      char *value = strchr(field, '=');
+      if (value && value - field < CAL_CACHE_NAME_WIDTH) {
+         *value++ = 0;
+         strcpy(entry->params[entry->nparams], field);
+         entry->values[entry->nparams] = atoi(value);
+         entry->nparams++;
+      }
+   }
+   return 1;
+}
+
+static void load_cache() {
+   if (loaded_cpld == cpld) {
+      return;
+   }
+   loaded_cpld = cpld;
+   num_entries = 0;
+   int bytes = file_load_calibration(buffer, sizeof(buffer) - 1);
+   char *line = buffer;
+   while (bytes > 0 && *line && num_entries < CAL_CACHE_MAX_ENTRIES) {
+      char *eol = strpbrk(line, "\r\n");
+      if (eol) {
+         *eol++ = 0;
+      }
+      if (parse_entry(line, &entries[num_entries])) {
+         num_entries++;
+      }
+      if (!eol) {
+         break;
+      }
+      line = eol + strspn(eol, "\r\n");
+   }
+   log_info("Calibration cache: %d entries for %s", num_entries, cpld->name);
+}
+
+static void save_cache() {
+   char *pointer = buffer;
+   char *end = buffer + sizeof(buffer);
+   for (int i = 0; i < num_entries; i++) {
+      cal_cache_entry_t *entry = &entries[i];
+      cal_cache_key_t *key = &entry->key;
+      // An entry that doesn't fit is left out (n >= space), along with the rest
+      int space = end - pointer;
+      int n = snprintf(pointer, space, "%s,%s,%d,%d,%d,%d", key->profile, key->sub_profile, key->mode7, key->line_time_ns, key->lines_per_frame, key->clock);
+      for (int j = 0; j < entry->nparams && n < space; j++) {
+         n += snprintf(pointer + n, space - n, ",%s=%d", entry->params[j], entry->values[j]);
+      }
+      if (n < space) {
+         n += snprintf(pointer + n, space - n, "\r\n");
+      }
+      if (n >= space) {
+         log_warn("Calibration cache: buffer full, %d entries not saved", num_entries - i);
+         break;
+      }
+      pointer += n;
+   }
+   file_save_calibration(buffer, pointer - buffer);
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+// The sample offsets are the visible values whose names end in "offset"
+int is_offset_param(param_t *param) {
+   const char *name = param->property_name;
+   int len = strlen(name);
+   return !param->hidden && len >= 6 && strcmp(name + len - 6, "offset") == 0;
+}
+
+// Calibration results are the sample offsets, the delays and the DAC levels
+int is_calibration_param(param_t *param) {
+   const char *name = param->property_name;
+   if (param->hidden) {
+      return 0;
+   }
+   if (is_offset_param(param)) {
+      return 1;
+   }
+   return strcmp(name, "half") == 0 || strcmp(name, "delay") == 0 || strncmp(name, "dac_", 4) == 0;
+}
+
+int cal_cache_apply(cal_cache_key_t *key) {
+   load_cache();
+   num_undo = 0;
+   cal_cache_entry_t *entry = find_entry(key);
+   if (entry == NULL) {
+      log_info("Calibration cache: miss");
+      return 0;
+   }
+   int applied = 0;
+   for (int i = 0; i < entry->nparams; i++) {
+      int param = find_param(entry->params[i]);
+      if (param < 0) {
+         log_warn("Calibration cache: unknown parameter %s", entry->params[i]);
+         continue;
+      }
+      undo_params[num_undo] = param;
+      undo_values[num_undo] = cpld->get_value(param);
+      num_undo++;
+      cpld->set_value(param, entry->values[i]);
+      applied++;
+   }
+   log_info("Calibration cache: applied %d values", applied);
+   // An entry none of whose names match (e.g. from an older file) is treated as a miss
+   return applied > 0;
+}
+
+void cal_cache_undo() {
+   // In reverse, in case a parameter appeared twice in the entry
+   while (num_undo > 0) {
+      num_undo--;
+      cpld->set_value(undo_params[num_undo], undo_values[num_undo]);
+   }
+}
+
+void cal_cache_store(cal_cache_key_t *key) {
+   // Commas separate the fields of the file
+   if (strchr(key->profile, ',') || strchr(key->sub_profile, ',')) {
+      log_warn("Calibration cache: not stored, profile name contains a comma");
+      return;
+   }
+   load_cache();
+   cal_cache_entry_t *entry = find_entry(key);
+   if (entry == NULL) {
+      if (num_entries < CAL_CACHE_MAX_ENTRIES) {
+         entry = &entries[num_entries++];
+      } else {
+         // Full, so drop the oldest entry
+         memmove(&entries[0], &entries[1], (CAL_CACHE_MAX_ENTRIES - 1) * sizeof(cal_cache_entry_t));
+         entry = &entries[CAL_CACHE_MAX_ENTRIES - 1];
+      }
+   }
+   memcpy(&entry->key, key, sizeof(cal_cache_key_t));
+   entry->nparams = 0;
+   param_t *params = cpld->get_params();
+   for (int i = 0; params[i].key >= 0 && entry->nparams < CAL_CACHE_MAX_PARAMS; i++) {
+      if (is_calibration_param(&params[i])) {
+         strncpy(entry->params[entry->nparams], params[i].property_name, CAL_CACHE_NAME_WIDTH - 1);
+         entry->params[entry->nparams][CAL_CACHE_NAME_WIDTH - 1] = 0;
+         entry->values[entry->nparams] = cpld->get_value(params[i].key);
+         entry->nparams++;
+      }
+   }
+   log_info("Calibration cache: stored %d values", entry->nparams);
+   save_cache();
+}
@@ -0,0 +1,44 @@
+#ifndef CAL_CACHE_H
+#define CAL_CACHE_H
+
+#include "defs.h"
+#include "cpld.h"
+
+// =============================================================
+// Calibration cache
+// =============================================================
+//
+// Remembers the results of a calibration started from the menu (the sample
+// offsets, the half and full pixel delays and the DAC levels) for each
+// source timing, so they can be applied again on a mode change. Nothing is
+// calibrated automatically: without a usable entry the profile's values stay.
+//
+// There is one file per CPLD design, in Saved_Profiles next to the saved
+// profiles for that design. It is read once, after that lookups are in RAM.
+
+typedef struct {
+   char profile[MAX_PROFILE_WIDTH];
+   char sub_profile[MAX_PROFILE_WIDTH];   // empty if the profile has no sub profiles
+   int mode7;
+   int line_time_ns;                      // measured, matched within CAL_CACHE_LINE_TOLERANCE
+   int lines_per_frame;
+   int clock;                             // sampling clock in Hz (from the profile geometry)
+} cal_cache_key_t;
+
+// Applies the cached results for key to the CPLD, returns 1 if there were any
+int cal_cache_apply(cal_cache_key_t *key);
+
+// Puts back the CPLD values the last cal_cache_apply replaced
+void cal_cache_undo();
+
+// Records the current CPLD calibration results for key and saves the cache.
+// Profile names containing a comma aren't stored, as commas separate the fields
+void cal_cache_store(cal_cache_key_t *key);
+
+// Returns 1 if param is one of the CPLD sample offsets
+int is_offset_param(param_t *param);
+
+// Returns 1 if param is one of the CPLD values that calibration sets
+int is_calibration_param(param_t *param);
+
+#endif
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "defs.h"
+#include "cpld.h"
+#include "logging.h"
+#include "filesystem.h"
+#include "rpi-systimer.h"
+#include "cal_cache.h"
+#include "cal_log.h"
+
+static const char *reason_names[] = {
+   "manual",
+   "new",
+   "cached",
+   "stale"
+};
+
+static const char *phase_names[] = {
+   "clock",
+   "verify",
+   "mask",
+   "dac",
+   "sample"
+};
+
+static unsigned int start_time;
+static unsigned int phase_time[NUM_CAL_PHASES];
+static int range;
+static int metrics[CAL_LOG_MAX_VALUES];
+static int frames;
+
+static char header[512];
+static char buffer[CAL_LOG_RECORD_SIZE];
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void cal_log_begin() {
+   start_time = cal_log_now();
+   for (int i = 0; i < NUM_CAL_PHASES; i++) {
+      phase_time[i] = 0;
+   }
+   range = 0;
+   frames = 0;
+}
+
+unsigned int cal_log_now() {
+   return RPI_GetSystemTimer()->counter_lo;
+}
+
+void cal_log_add(int phase, unsigned int start) {
+   phase_time[phase] += cal_log_now() - start;
+}
+
+void cal_log_set(int phase, unsigned int us) {
+   phase_time[phase] = us;
+   start_time -= us;
+}
+
+void cal_log_metrics(int new_range, int *new_metrics, int new_frames) {
+   range = (new_range < CAL_LOG_MAX_VALUES) ? new_range : CAL_LOG_MAX_VALUES;
+   for (int i = 0; i < range; i++) {
+      metrics[i] = new_metrics[i];
+   }
+   frames = new_frames;
+}
+
+void cal_log_end(int reason, cal_cache_key_t *key, int clock_error_ppm, int errors) {
+   unsigned int now = cal_log_now();
+   unsigned int total = now - start_time;
+   unsigned int other = total;
+   char *hp = header;
+   char *bp = buffer;
+
+   hp += sprintf(hp, "uptime_ms,cpld,profile,sub_profile,mode7,reason,clock,clock_ppm,line_ns,lines,errors,frames,metrics,values");
+   bp += sprintf(bp, "%u,%s,%s,%s,%d,%s,%d,%d,%d,%d,%d,%d,", now / 1000, cpld->name, key->profile, key->sub_profile, key->mode7,
+                 reason_names[reason], key->clock, clock_error_ppm, key->line_time_ns, key->lines_per_frame, errors, frames);
+   // Space separated lists, as the values are in a single column
+   for (int i = 0; i < range; i++) {
+      bp += sprintf(bp, i ? " %d" : "%d", metrics[i]);
+   }
+   *bp++ = ',';
+   param_t *params = cpld->get_params();
+   for (int i = 0, n = 0; params[i].key >= 0 && bp - buffer < CAL_LOG_RECORD_SIZE - 256; i++) {
+      if (is_calibration_param(&params[i])) {
+         bp += sprintf(bp, n++ ? " %s=%d" : "%s=%d", params[i].property_name, cpld->get_value(params[i].key));
+      }
+   }
+   for (int i = 0; i < NUM_CAL_PHASES; i++) {
+      hp += sprintf(hp, ",t_%s_ms", phase_names[i]);
+      bp += sprintf(bp, ",%u", phase_time[i] / 1000);
+      other -= phase_time[i];
+   }
+   hp += sprintf(hp, ",t_other_ms,t_total_ms\r\n");
+   bp += sprintf(bp, ",%u,%u\r\n", other / 1000, total / 1000);
+
+   log_info("Calibration log: %s, errors = %d, %u ms", reason_names[reason], errors, total / 1000);
+   file_append_cal_log(header, buffer, bp - buffer);
+}
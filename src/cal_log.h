@@ -0,0 +1,57 @@
+#ifndef CAL_LOG_H
+#define CAL_LOG_H
+
+#include "defs.h"
+#include "cal_cache.h"
+
+// =============================================================
+// Calibration log
+// =============================================================
+//
+// Appends one line per calibration run to /Captures/cal_log on the SD card,
+// so calibration speed and reliability can be compared across sources (scripts/cal_log_summary.sh summarises the file). The columns are
+// named in the header line written when the file is created.
+//
+// A record is started with cal_log_begin, the calibration code adds its
+// measurements as it runs, and cal_log_end writes the record out. Runs that
+// only verify a cached result are recorded too, so the hit rate can be seen.
+
+// Why calibration ran
+enum {
+   CAL_LOG_MANUAL,     // from the menu
+   CAL_LOG_NEW,        // new source timing, nothing cached (no longer written, as that doesn't calibrate)
+   CAL_LOG_CACHED,     // new source timing, cached result verified (so no calibration)
+   CAL_LOG_STALE,      // new source timing, cached result failed verification (so not used)
+   NUM_CAL_LOG_REASONS
+};
+
+// Where the time went
+enum {
+   CAL_PHASE_CLOCK,    // measuring the sampling clock and sync timings
+   CAL_PHASE_VERIFY,   // checking a cached result
+   CAL_PHASE_MASK,     // building the volatile mask
+   CAL_PHASE_DAC,      // sweeping the threshold DACs
+   CAL_PHASE_SAMPLE,   // searching the sample points
+   NUM_CAL_PHASES
+};
+
+void cal_log_begin();
+
+// The system timer in microseconds, for timing phases
+unsigned int cal_log_now();
+
+// Adds the time since start to a phase
+void cal_log_add(int phase, unsigned int start);
+
+// Sets the time of a phase that ran just before the record was started
+// (it is included in the total)
+void cal_log_set(int phase, unsigned int us);
+
+// The metric for each sample point value (-1 if it wasn't measured), and the number of
+// frames measured to get them
+void cal_log_metrics(int range, int *metrics, int frames);
+
+// Writes the record with the chosen CPLD values and the final errors
+void cal_log_end(int reason, cal_cache_key_t *key, int clock_error_ppm, int errors);
+
+#endif
@@ -52,6 +52,19 @@ typedef struct {
 
 int diff_N_frames(capture_info_t *capinfo, int n, int mode7, int elk);
 int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk);
+void build_volatile_mask(capture_info_t *capinfo, int mode7, int elk);
+int calibrate_sample_points(capture_info_t *capinfo, int range, int n, int *metrics, int elk, int (*measure)(capture_info_t *capinfo, int value, int n, int elk));
+#ifdef CAL_DAC_LEVELS
+// The result of sweeping one comparator threshold DAC
+typedef struct {
+   int old_value;                      // -1 if the DAC hasn't been calibrated
+   int value;                          // -1 if no gap was found (and so old_value was kept)
+   int histogram[CAL_DAC_STEPS];       // pixels that changed between adjacent sweep values
+} dac_level_t;
+
+int calibrate_dac_level(capture_info_t *capinfo, int mode7, int num, int upper, dac_level_t *level);
+const char *dac_level_histogram(dac_level_t *level);
+#endif
 signed int analyze_default_alignment(capture_info_t *capinfo);
 signed int analyze_mode7_alignment(capture_info_t *capinfo);
 
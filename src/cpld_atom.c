@@ -121,9 +121,19 @@ static int cpld_get_version() {
    return cpld_version;
 }
 
+// Measures the errors at one sample point value, for calibrate_sample_points
+static int cpld_measure(capture_info_t *capinfo, int value, int n, int elk) {
+   int metric;
+   config->sp_offset = value;
+   write_config(config);
+   metric = diff_N_frames(capinfo, n, 0, elk);
+   log_info("INFO: value = %d: metric = %d (%d frames)", value, metric, n);
+   osd_sp(config, 2, metric * NUM_CAL_FRAMES / n);
+   return metric;
+}
+
 static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    int min_i = 0;
-   int metric;         // this is a point value (at one sample offset)
    int min_metric;
    int win_metric;     // this is a windowed value (over three sample offsets)
    int min_win_metric;
@@ -132,29 +142,22 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    log_info("Calibrating...");
 
    // Measure the error metrics at all possible offset values
-   min_metric = INT_MAX;
    printf("INFO:                      ");
    for (int i = 0; i < NUM_OFFSETS; i++) {
       printf("%7c", 'A' + i);
    }
    printf("   total\r\n");
-   for (int value = 0; value < range; value++) {
-      config->sp_offset = value;
-      write_config(config);
-      metric = diff_N_frames(capinfo, NUM_CAL_FRAMES, 0, elk);
-      log_info("INFO: value = %d: metric = ", metric);
-      sum_metrics[value] = metric;
-      osd_sp(config, 2, metric);
-      if (metric < min_metric) {
-         min_metric = metric;
-      }
-   }
+   min_metric = calibrate_sample_points(capinfo, range, NUM_CAL_FRAMES, sum_metrics, elk, cpld_measure);
 
    // Use a 3 sample window to find the minimum and maximum
    min_win_metric = INT_MAX;
    for (int i = 0; i < range; i++) {
       int left  = (i - 1 + range) % range;
       int right = (i + 1 + range) % range;
+      // Skip windows with a value that wasn't measured (see calibrate_sample_points)
+      if (sum_metrics[left] < 0 || sum_metrics[right] < 0) {
+         continue;
+      }
       win_metric = sum_metrics[left] + sum_metrics[i] + sum_metrics[right];
       if (sum_metrics[i] == min_metric) {
          if (win_metric < min_win_metric) {
@@ -180,6 +180,18 @@ static param_t params[] = {
    {          -1,          NULL,          NULL, 0,   0, 1 }
 };
 
+#ifdef CAL_DAC_LEVELS
+// The comparator threshold DACs, alternately Hi and Lo
+static const int dac_level_params[] = { DAC_A, DAC_B, DAC_C, DAC_D };
+#define NUM_DAC_LEVELS 4
+
+// Threshold DAC sweep results for mode 0..6
+static dac_level_t dac_levels_default[NUM_DAC_LEVELS];
+
+// Threshold DAC sweep results for mode 7
+static dac_level_t dac_levels_mode7[NUM_DAC_LEVELS];
+#endif
+
 // =============================================================
 // Private methods
 // =============================================================
@@ -544,19 +556,45 @@ static void cpld_init(int version) {
    }
    errors_default = -1;
    errors_mode7 = -1;
+#ifdef CAL_DAC_LEVELS
+   for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+      dac_levels_default[i].old_value = -1;
+      dac_levels_mode7[i].old_value = -1;
+   }
+#endif
 }
 
 static int cpld_get_version() {
    return cpld_version;
 }
 
+// Measures the errors at one sample point value, for calibrate_sample_points
+static int cpld_measure(capture_info_t *capinfo, int value, int n, int elk) {
+   int (*raw_metrics)[8][NUM_OFFSETS] = mode7 ? &raw_metrics_mode7 : &raw_metrics_default;
+   int *by_sample_metrics;
+   int metric = 0;
+   for (int i = 0; i < NUM_OFFSETS; i++) {
+      config->sp_offset[i] = value;
+   }
+   write_config(config);
+   by_sample_metrics = diff_N_frames_by_sample(capinfo, n, mode7, elk);
+   printf("INFO: value = %d: metrics = ", value);
+   for (int i = 0; i < NUM_OFFSETS; i++) {
+      // Raw metrics are always for NUM_CAL_FRAMES frames
+      (*raw_metrics)[value][i] = by_sample_metrics[i] * NUM_CAL_FRAMES / n;
+      metric += by_sample_metrics[i];
+      printf("%7d", by_sample_metrics[i]);
+   }
+   printf("%8d (%d frames)\r\n", metric, n);
+   osd_sp(config, 2, metric * NUM_CAL_FRAMES / n);
+   return metric;
+}
+
 static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    int min_i = 0;
-   int metric;         // this is a point value (at one sample offset)
    int min_metric;
    int win_metric;     // this is a windowed value (over three sample offsets)
    int min_win_metric;
-   int *by_sample_metrics;
 
    int range;          // 0..5 in Modes 0..6, 0..7 in Mode 7
    int *sum_metrics;
@@ -578,9 +616,18 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    }
    range = config->divider;
 
+#ifdef CAL_DAC_LEVELS
+   // Set the thresholds before the sample points, as they depend on them
+   if (supports_analog) {
+      dac_level_t *levels = mode7 ? dac_levels_mode7 : dac_levels_default;
+      for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+         calibrate_dac_level(capinfo, mode7, dac_level_params[i], !(i & 1), &levels[i]);
+      }
+   }
+#endif
+
    // Measure the error metrics at all possible offset values
    old_full_px_delay = config->full_px_delay;
-   min_metric = INT_MAX;
    config->half_px_delay = 0;
    config->full_px_delay = 0;
    printf("INFO:                      ");
@@ -588,32 +635,17 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
       printf("%7c", 'A' + i);
    }
    printf("   total\r\n");
-   for (int value = 0; value < range; value++) {
-      for (int i = 0; i < NUM_OFFSETS; i++) {
-         config->sp_offset[i] = value;
-      }
-      write_config(config);
-      by_sample_metrics = diff_N_frames_by_sample(capinfo, NUM_CAL_FRAMES, mode7, elk);
-      metric = 0;
-      printf("INFO: value = %d: metrics = ", value);
-      for (int i = 0; i < NUM_OFFSETS; i++) {
-         (*raw_metrics)[value][i] = by_sample_metrics[i];
-         metric += by_sample_metrics[i];
-         printf("%7d", by_sample_metrics[i]);
-      }
-      printf("%8d\r\n", metric);
-      sum_metrics[value] = metric;
-      osd_sp(config, 2, metric);
-      if (metric < min_metric) {
-         min_metric = metric;
-      }
-   }
+   min_metric = calibrate_sample_points(capinfo, range, NUM_CAL_FRAMES, sum_metrics, elk, cpld_measure);
 
    // Use a 3 sample window to find the minimum and maximum
    min_win_metric = INT_MAX;
    for (int i = 0; i < range; i++) {
       int left  = (i - 1 + range) % range;
       int right = (i + 1 + range) % range;
+      // Skip windows with a value that wasn't measured (see calibrate_sample_points)
+      if (sum_metrics[left] < 0 || sum_metrics[right] < 0) {
+         continue;
+      }
       win_metric = sum_metrics[left] + sum_metrics[i] + sum_metrics[right];
       if (sum_metrics[i] == min_metric) {
          if (win_metric < min_win_metric) {
@@ -995,6 +1027,20 @@ static void cpld_show_cal_details(int line) {
          sprintf(message, "Offset %d: Errors = %6d", value, sum_metrics[value]);
          osd_set(line + value, 0, message);
       }
+#ifdef CAL_DAC_LEVELS
+      dac_level_t *levels = mode7 ? dac_levels_mode7 : dac_levels_default;
+      if (levels[0].old_value >= 0) {
+         for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+            const char *label = params[dac_level_params[i]].label;
+            if (levels[i].value < 0) {
+               sprintf(message, "%-13s: %3d (no gap)", label, levels[i].old_value);
+            } else {
+               sprintf(message, "%-13s: %3d -> %3d", label, levels[i].old_value, levels[i].value);
+            }
+            osd_set(line + range + 1 + i, 0, message);
+         }
+      }
+#endif
    }
 }
 
@@ -1013,6 +1059,16 @@ static void cpld_show_cal_raw(int line) {
          }
          osd_set(line + value, 0, message);
       }
+#ifdef CAL_DAC_LEVELS
+      // One histogram per threshold DAC, from 0 on the left to 255 on the right
+      dac_level_t *levels = mode7 ? dac_levels_mode7 : dac_levels_default;
+      if (levels[0].old_value >= 0) {
+         for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+            sprintf(message, "%c:%s", 'A' + dac_level_params[i] - DAC_A, dac_level_histogram(&levels[i]));
+            osd_set(line + range + 1 + i, 0, message);
+         }
+      }
+#endif
    }
 }
 
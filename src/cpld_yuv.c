@@ -174,6 +174,15 @@ static param_t params[] = {
    {          -1,  NULL,                  NULL, 0,   0, 0 }
 };
 
+#ifdef CAL_DAC_LEVELS
+// The comparator threshold DACs, alternately Hi and Lo
+static const int dac_level_params[] = { DAC_A, DAC_B, DAC_C, DAC_D };
+#define NUM_DAC_LEVELS 4
+
+// Threshold DAC sweep results
+static dac_level_t dac_levels[NUM_DAC_LEVELS];
+#endif
+
 // =============================================================
 // Private methods
 // =============================================================
@@ -371,6 +380,11 @@ static void cpld_init(int version) {
       sum_metrics[i] = -1;
    }
    errors = -1;
+#ifdef CAL_DAC_LEVELS
+   for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+      dac_levels[i].old_value = -1;
+   }
+#endif
 
    int major = (cpld_version >> VERSION_MAJOR_BIT) & 0x0F;
 
@@ -415,9 +429,19 @@ static int cpld_get_version() {
    return cpld_version;
 }
 
+// Measures the errors at one sample point value, for calibrate_sample_points
+static int cpld_measure(capture_info_t *capinfo, int value, int n, int elk) {
+   int metric;
+   config->sp_offset = value;
+   write_config(config);
+   metric = diff_N_frames(capinfo, n, 0, elk);
+   log_info("INFO: value = %d: metric = %d (%d frames)", value, metric, n);
+   osd_sp(config, 2, metric * NUM_CAL_FRAMES / n);
+   return metric;
+}
+
 static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    int min_i = 0;
-   int metric;         // this is a point value (at one sample offset)
    int min_metric;
    int win_metric;     // this is a windowed value (over three sample offsets)
    int min_win_metric;
@@ -426,30 +450,30 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
 
    log_info("Calibrating...");
 
+#ifdef CAL_DAC_LEVELS
+   // Set the thresholds before the sample point, as it depends on them
+   for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+      calibrate_dac_level(capinfo, 0, dac_level_params[i], !(i & 1), &dac_levels[i]);
+   }
+#endif
+
    // Measure the error metrics at all possible offset values
-   min_metric = INT_MAX;
    printf("INFO:                      ");
    for (int i = 0; i < NUM_OFFSETS; i++) {
       printf("%7c", 'A' + i);
    }
    printf("   total\r\n");
-   for (int value = 0; value < range; value++) {
-      config->sp_offset = value;
-      write_config(config);
-      metric = diff_N_frames(capinfo, NUM_CAL_FRAMES, 0, elk);
-      log_info("INFO: value = %d: metric = ", metric);
-      sum_metrics[value] = metric;
-      osd_sp(config, 2, metric);
-      if (metric < min_metric) {
-         min_metric = metric;
-      }
-   }
+   min_metric = calibrate_sample_points(capinfo, range, NUM_CAL_FRAMES, sum_metrics, elk, cpld_measure);
 
    // Use a 3 sample window to find the minimum and maximum
    min_win_metric = INT_MAX;
    for (int i = 0; i < range; i++) {
       int left  = (i - 1 + range) % range;
       int right = (i + 1 + range) % range;
+      // Skip windows with a value that wasn't measured (see calibrate_sample_points)
+      if (sum_metrics[left] < 0 || sum_metrics[right] < 0) {
+         continue;
+      }
       win_metric = sum_metrics[left] + sum_metrics[i] + sum_metrics[right];
       if (sum_metrics[i] == min_metric) {
          if (win_metric < min_win_metric) {
@@ -689,8 +713,37 @@ static void cpld_show_cal_details(int line) {
             osd_set(line + value, 0, message);
          }
       }
+#ifdef CAL_DAC_LEVELS
+      int rows = (range > 8) ? range >> 1 : range;
+      if (dac_levels[0].old_value >= 0) {
+         for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+            const char *label = params[dac_level_params[i]].label;
+            if (dac_levels[i].value < 0) {
+               sprintf(message, "%-13s: %3d (no gap)", label, dac_levels[i].old_value);
+            } else {
+               sprintf(message, "%-13s: %3d -> %3d", label, dac_levels[i].old_value, dac_levels[i].value);
+            }
+            osd_set(line + rows + 1 + i, 0, message);
+         }
+      }
+#endif
+   }
+}
+
+#ifdef CAL_DAC_LEVELS
+static void cpld_show_cal_raw(int line) {
+   if (dac_levels[0].old_value < 0) {
+      sprintf(message, "No calibration data for this mode");
+      osd_set(line, 0, message);
+   } else {
+      // One histogram per threshold DAC, from 0 on the left to 255 on the right
+      for (int i = 0; i < NUM_DAC_LEVELS; i++) {
+         sprintf(message, "%c:%s", 'A' + dac_level_params[i] - DAC_A, dac_level_histogram(&dac_levels[i]));
+         osd_set(line + i, 0, message);
+      }
    }
 }
+#endif
 
 static int cpld_old_firmware_support() {
     return 0;
@@ -744,5 +797,8 @@ cpld_t cpld_yuv = {
    .get_value_string = cpld_get_value_string,
    .set_value = cpld_set_value,
    .show_cal_summary = cpld_show_cal_summary,
-   .show_cal_details = cpld_show_cal_details
+   .show_cal_details = cpld_show_cal_details,
+#ifdef CAL_DAC_LEVELS
+   .show_cal_raw = cpld_show_cal_raw
+#endif
 };
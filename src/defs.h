@@ -24,6 +24,88 @@
 // (it can be set to less that this on the OSD)
 #define NBUFFERS 4
 
+// Enable per-line cycle counting of the capture_line functions
+// (results are summarised on the UART every INSTRUMENT_CAPTURE_INTERVAL fields)
+// #define INSTRUMENT_CAPTURE
+
+// The maximum number of lines per field that are instrumented
+#define INSTRUMENT_CAPTURE_MAX_LINES 1024
+
+// The number of fields accumulated before each report is logged
+#define INSTRUMENT_CAPTURE_INTERVAL 250
+
+// Benchmark builds (cmake -DBENCHMARK=1) time every capture line function at startup
+#ifdef BENCHMARK
+#ifndef INSTRUMENT_CAPTURE
+#define INSTRUMENT_CAPTURE
+#endif
+// The number of fields captured with each function
+#define BENCHMARK_FIELDS 50
+// Largest line (in words) used by the Mode 7 reference deinterlacer benchmark
+#define MODE7_REF_MAX_WORDS 256
+// The percentage a function may exceed its psync budget by before it is reported as failing
+#ifndef BENCHMARK_MARGIN
+#define BENCHMARK_MARGIN 10
+#endif
+#endif
+
+// Calibration measures every sample point value over a few frames, then only
+// measures the values that could be the best over the full number of frames
+// (if not defined, every value is measured over the full number of frames)
+#define CAL_COARSE_TO_FINE
+
+// The number of frames each value is measured over in the coarse sweep
+#define NUM_CAL_COARSE_FRAMES 2
+
+// Calibration ignores the parts of the screen that change by themselves (e.g.
+// flashing cursors), found by looking for cells that switch between two
+// stable states over a few frames before it starts (if not defined, or if
+// too much of the screen changes, the cursor rows of the Acorn screen modes
+// are skipped instead)
+#define CAL_VOLATILE_MASK
+
+#define CAL_MASK_MAX_LINES 1024       // frame buffer lines covered by the mask
+#define CAL_MASK_CELLS 32             // cells across each line (one bit each)
+#define CAL_MASK_FRAMES 16            // frames captured to find the volatile cells
+#define CAL_MASK_STABLE_FRAMES 2      // frames each state of a volatile cell must last (at most 15)
+#define CAL_MASK_MAX_PERCENT 10       // if more cells than this change, it's sampling noise rather than content
+
+// Calibration of the analog frontends first sweeps each comparator threshold
+// DAC and places it in the middle of a gap between the levels the source
+// produces (if not defined, the DAC values from the profile are used)
+// #define CAL_DAC_LEVELS
+
+#define CAL_DAC_STEPS 32              // histogram bins per sweep (CAL_DAC_STEPS + 1 DAC values, evenly spaced over 0..255)
+#define CAL_DAC_COARSE_STEPS 8        // bins of the first, coarse sweep (must divide CAL_DAC_STEPS)
+#define CAL_DAC_FRAMES 1              // frames captured at each DAC value
+#define CAL_DAC_MIN_PIXELS 64         // if fewer pixels than this change over a sweep, the DAC isn't used in this mode
+#define CAL_DAC_GAP_RATIO 32          // a histogram bin is empty if it has less than 1/N of the largest bin
+
+// Remember the results of each calibration started from the menu for the
+// source timing on the SD card, and apply them on a mode change if they
+// still give a stable capture (nothing is calibrated automatically)
+// #define CAL_CACHE
+
+// The maximum number of timings remembered for each CPLD design
+#define CAL_CACHE_MAX_ENTRIES 64
+
+// The maximum number of CPLD parameters remembered for each timing
+#define CAL_CACHE_MAX_PARAMS 24
+
+// Size of the buffer the cache file is read into and written from
+#define CAL_CACHE_BUFFER_SIZE 32768
+
+// How close (in PPM) the measured line time must be to match an entry
+#define CAL_CACHE_LINE_TOLERANCE 1000
+
+// Append a record of each calibration run (metrics, chosen values, errors,
+// clock error and the time taken by each phase) to Captures/cal_log
+// #define CAL_LOG
+
+#define CAL_LOG_MAX_VALUES 16         // sample point values recorded (the YUV CPLD has up to 16)
+#define CAL_LOG_RECORD_SIZE 1024      // maximum length of a record
+#define CAL_LOG_MAX_SIZE 262144       // when the log would grow past this it's moved to cal_log.old and restarted
+
 #define VSYNCINT 16
 
 // Control bits (maintained in r3)
@@ -103,8 +185,11 @@
 // Indicate the platform has multiple cores
 #define HAS_MULTICORE                // puts unused cores to sleep
 #endif
-#if defined(RPI3)
-#define USE_MULTICORE                // makes Advanced Motion deinterlace use 2nd core
+#if defined(RPI2) || defined(RPI3) || defined(RPI4)
+// Makes the capture line functions take their psync samples from the 2nd core
+// (see run_core in rgb_to_fb.S). Off until a BENCHMARK build on each Pi shows
+// the capture functions still fit their psync budget with it
+//#define USE_MULTICORE
 #endif
 #if defined(RPI2) || defined(RPI3)   // Pi4 may not need these
 #define USE_ALT_DEINTERLACE_CODE     // uses re-ordered code for bob and simple motion deinterlace
@@ -112,6 +197,69 @@
 #define INHIBIT_DOUBLE_HEIGHT        // inhibit line doubling as it causes memory stalls with Pi2 & Pi3
 #endif
 
+// Capture each line into a cached staging buffer and copy it to the (uncached)
+// frame buffer in bursts after the line has ended, rather than storing each
+// word as it is captured (can be changed at runtime via line_staging). Off
+// until a BENCHMARK build shows the staged functions are faster on the Pi 2/3
+// #define USE_LINE_STAGING
+
+// Lines with a larger pitch than this are always captured directly
+#define LINE_STAGING_MAX_PITCH 4096
+
+// Size of the ring of raw GPLEV0 samples passed from core 1 to the capture
+// line functions (log2 of the number of words, must exceed the psync edges in a line)
+#define SAMPLE_RING_SHIFT 11
+
+// Measure the jitter of each line's hsync against a running model of the
+// line timing and move the capture start by whole psync edges to cancel it
+// (only active while jitter_edge_cycles is non-zero)
+// #define USE_JITTER_COMPENSATION
+
+// Jitter histogram: number of bins (as a power of 2) and width of each bin in cycles (as a power of 2)
+#define JITTER_BINS_SHIFT 5
+#define JITTER_BINS (1 << JITTER_BINS_SHIFT)
+#define JITTER_BIN_SHIFT 4
+
+// Compare the live frames with the OSD off a band of lines per field, at the
+// current sample offsets, and move the offsets by one step when the errors
+// consistently sit on one edge of the pixels, to follow phase drift as the
+// source warms up (nothing extra is captured or displayed)
+// #define USE_CAL_MONITOR
+
+#define CAL_MONITOR_BAND_LINES 8      // frame buffer lines compared per field
+#define CAL_MONITOR_HYSTERESIS 2      // the errors lean to one edge if it has N times those of the other
+#define CAL_MONITOR_CONSISTENT 3      // consecutive frames the errors must lean the same way before moving
+
+// Time whole frames while capturing and re-trim the sampling clock as the
+// source drifts, rather than relying only on calibrate_sampling_clock. Off
+// until it has been shown not to disturb capture when it rewrites the PLL
+// #define USE_CLOCK_TRACKER
+
+#define CLOCK_TRACKER_FRAMES 250      // frames (pairs of fields) averaged for each measurement
+#define CLOCK_TRACKER_REJECT_PPM 500  // frames further than this from the average are ignored
+#define CLOCK_TRACKER_MIN_TRIM 1.0    // smallest change of the sampling clock written to the PLL (in PPM)
+#define CLOCK_TRACKER_CONFIRM 2       // consecutive measurements that must call for a trim the same way
+#define CLOCK_TRACKER_HOLDOFF 6       // measurements after a trim before the PLL is written again
+
+// Skip copying staged lines that are unchanged since they were last written
+// to the same buffer (only has an effect when line staging is on)
+// #define USE_LINE_SKIP
+
+// The number of lines per field that are checksummed (as a power of 2)
+#define LINE_SKIP_MAX_LINES_SHIFT 10
+#define LINE_SKIP_MAX_LINES (1 << LINE_SKIP_MAX_LINES_SHIFT)
+
+// Motion map used by the Advanced Motion (Map) deinterlace: one byte per
+// character per line per field, holding the last deinterlace decision and
+// the number of fields left before that decision is reused without checking
+#define MOTION_MAP_MAX_LINES 320
+#define MOTION_MAP_CHARS_SHIFT 6
+#define MOTION_MAP_MAX_CHARS (1 << MOTION_MAP_CHARS_SHIFT)
+#define MOTION_MAP_SIZE (MOTION_MAP_MAX_LINES << (MOTION_MAP_CHARS_SHIFT + 1))
+#define MOTION_MAP_HYSTERESIS 4      // fields a character stays checked for after it last changed
+#define MOTION_MAP_DEINTERLACE 0x80  // the last decision was to deinterlace
+#define MOTION_MAP_COUNT_MASK 0x7f
+
 #ifdef __ASSEMBLER__
 
 #define GPFSEL0 (PERIPHERAL_BASE + 0x200000)  // controls GPIOs 0..9
@@ -284,6 +432,57 @@ typedef struct {
 #define GENLOCK_LOCKED_THRESHOLD 2
 #define GENLOCK_FRAME_DELAY 12
 
+// The genlock controller: GENLOCK_PI (proportional-integral, with a continuous
+// adjustment) or GENLOCK_STEPPER (the adjustment stepped through GENLOCK_THRESHOLDS)
+#define GENLOCK_CONTROLLER GENLOCK_PI
+
+#define GENLOCK_PI_FIELDS 25          // closed loop time constant in fields (doubled at the slower genlock speeds)
+#define GENLOCK_PI_LOCK_LINES 1       // locked once the difference is within this many lines...
+#define GENLOCK_PI_LOCK_FIELDS 10     // ...for this many fields
+#define GENLOCK_PI_MIN_CHANGE 0.5     // smallest change of adjustment (in PPM) written to PLLH
+#define GENLOCK_PI_DEADBAND_LINES 2   // once locked, differences within this many lines are ignored
+#define GENLOCK_PI_WRITE_FIELDS 10    // once locked, fields between writes to PLLH
+#define GENLOCK_PI_SEEDED_LOCK_FIELDS 2   // ...or this many when started from the genlock cache
+
+// Remember the source field rate genlock converged to for each profile on the
+// SD card, and start the PI controller from it when returning to the profile
+#define GENLOCK_CACHE
+
+#define GENLOCK_CACHE_MAX_ENTRIES 64
+#define GENLOCK_CACHE_BUFFER_SIZE 8192
+#define GENLOCK_CACHE_TOLERANCE 500   // ignore an entry further than this (in PPM) from the measured rate
+#define GENLOCK_CACHE_SAVE_PPM 1      // only rewrite the file for changes of at least this (in PPM)
+#define GENLOCK_CACHE_UPDATE_FIELDS 500   // how often the entry is refreshed while locked
+
+// Adds Rate Convert to the settings menu (off by default). When it's on and
+// the display isn't genlocked (genlock off, or the source and display rates
+// too far apart), the buffer flips are paced so frames are shown with a
+// steady cadence (see frc.h), and at least three buffers are used
+#define FRAME_RATE_CONVERSION
+
+#define FRC_GUARD_US 300              // flips this close to a display vsync wait for it to pass
+#define FRC_LOG_FRAMES 1500           // frames between logging the repeated and dropped counts
+
+// Measure the latency from capturing each frame to scanning it out, logged
+// every INSTRUMENT_LATENCY_INTERVAL frames and shown on the source summary
+// info page, to compare buffering, genlock and deinterlace settings
+// #define INSTRUMENT_LATENCY
+
+#define INSTRUMENT_LATENCY_INTERVAL 500
+
+#ifndef MULTI_BUFFER
+// Both of these work on the multi buffer flips
+#undef FRAME_RATE_CONVERSION
+#undef INSTRUMENT_LATENCY
+#endif
+
+// Timestamp the display vsyncs seen during capture, and flip through present_buffer
+#if defined(FRAME_RATE_CONVERSION) || defined(INSTRUMENT_LATENCY)
+#define TIME_DISPLAY_VSYNC
+#endif
+
+#define DISPLAY_VSYNC_MAX_PREDICT 60  // display vsyncs predicted from the last one seen
+
 #define BIT_NORMAL_FIRMWARE_V1 0x01
 #define BIT_NORMAL_FIRMWARE_V2 0x02
 
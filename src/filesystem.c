@@ -22,6 +22,9 @@
 #define SAVED_PROFILE_BASE "/Saved_Profiles"
 #define PALETTES_BASE "/Palettes"
 #define PALETTES_TYPE ".bin"
+#define CALIBRATION_FILE "Calibration.cal"
+#define GENLOCK_FILE "Genlock.cal"
+#define CAL_LOG_FILE "cal_log"
 
 static FATFS fsObject;
 static int capture_id = -1;
@@ -32,9 +35,11 @@ static int generate_png(capture_info_t *capinfo, uint8_t **png, unsigned int *pn
 
    LodePNGState state;
    lodepng_state_init(&state);
-   state.info_raw.colortype = LCT_PALETTE;
+   // 16bpp is direct colour so is saved as RGB rather than with a palette
+   int png_bytes = (capinfo->bpp == 16) ? 3 : 1;
+   state.info_raw.colortype = (capinfo->bpp == 16) ? LCT_RGB : LCT_PALETTE;
    state.info_raw.bitdepth = 8;
-   state.info_png.color.colortype = LCT_PALETTE;
+   state.info_png.color.colortype = state.info_raw.colortype;
    state.info_png.color.bitdepth = 8;
 
    int width = capinfo->width;
@@ -57,7 +62,7 @@ static int generate_png(capture_info_t *capinfo, uint8_t **png, unsigned int *pn
    int leftclip = (width - width43) / 2;
    int rightclip = leftclip + width43;
 
-   for (int i = 0; i < (1 << capinfo->bpp); i++) {
+   for (int i = 0; i < (1 << capinfo->bpp) && capinfo->bpp != 16; i++) {
       int triplet = osd_get_palette(i);
       int r = triplet & 0xff;
       int g = (triplet >> 8) & 0xff;
@@ -84,10 +89,31 @@ static int generate_png(capture_info_t *capinfo, uint8_t **png, unsigned int *pn
    width43 = (width >> hdouble) << hdouble;
    height = (height >> vdouble) << vdouble;
 
-   uint8_t png_buffer[png_width * png_height];
+   uint8_t png_buffer[png_width * png_height * png_bytes];
    uint8_t *pp = png_buffer;
 
-   if (capinfo->bpp == 8) {
+   if (capinfo->bpp == 16) {
+       for (int y = 0; y < height; y += (vdouble + 1)) {
+            for (int sy = 0; sy < vscale; sy++) {
+                uint16_t *fp = (uint16_t *) (capinfo->fb + capinfo->pitch * y);
+                for (int x = 0; x < width; x += (hdouble + 1)) {
+                    uint16_t single_pixel = *fp++;
+                    if (hdouble) fp++;
+                    if (x >= leftclip && x < rightclip) {
+                        // expand RGB565 to 8 bits per channel
+                        uint8_t r = ((single_pixel >> 11) & 0x1f) * 255 / 31;
+                        uint8_t g = ((single_pixel >> 5) & 0x3f) * 255 / 63;
+                        uint8_t b = (single_pixel & 0x1f) * 255 / 31;
+                        for (int sx = 0; sx < hscale; sx++) {
+                            *pp++ = r;
+                            *pp++ = g;
+                            *pp++ = b;
+                        }
+                    }
+                }
+            }
+       }
+   } else if (capinfo->bpp == 8) {
        for (int y = 0; y < height; y += (vdouble + 1)) {
             for (int sy = 0; sy < vscale; sy++) {
                 uint8_t *fp = capinfo->fb + capinfo->pitch * y;
@@ -800,6 +826,131 @@ int file_restore(char *dirpath, char *name) {
    return 1;
 }
 
+// Loads a file from the saved profile directory of the current CPLD design
+static int file_load_cpld_file(char *name, char *buffer, unsigned int buffer_size) {
+   char path[256];
+   sprintf(path, "%s/%s/%s", SAVED_PROFILE_BASE, cpld->name, name);
+   return file_load(path, buffer, buffer_size);
+}
+
+// Saves a file to the saved profile directory of the current CPLD design
+static int file_save_cpld_file(char *name, char *buffer, unsigned int buffer_size) {
+   FRESULT result;
+   char path[256];
+   FIL file;
+   unsigned int num_written = 0;
+   init_filesystem();
+
+   result = f_mkdir(SAVED_PROFILE_BASE);
+   if (result != FR_OK && result != FR_EXIST) {
+       log_warn("Failed to create dir %s (result = %d)", SAVED_PROFILE_BASE, result);
+   }
+   sprintf(path, "%s/%s", SAVED_PROFILE_BASE, cpld->name);
+   result = f_mkdir(path);
+   if (result != FR_OK && result != FR_EXIST) {
+       log_warn("Failed to create dir %s (result = %d)", path, result);
+   }
+   sprintf(path, "%s/%s/%s", SAVED_PROFILE_BASE, cpld->name, name);
+
+   log_info("Saving file %s", path);
+   result = f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS);
+   if (result != FR_OK) {
+      log_warn("Failed to open %s (result = %d)", path, result);
+      close_filesystem();
+      return result;
+   }
+   result = f_write(&file, buffer, buffer_size, &num_written);
+   if (result != FR_OK) {
+      log_warn("Failed to write %s (result = %d)", path, result);
+      f_close(&file);
+      close_filesystem();
+      return result;
+   }
+   result = f_close(&file);
+   if (result != FR_OK) {
+      log_warn("Failed to close %s (result = %d)", path, result);
+      close_filesystem();
+      return result;
+   }
+   close_filesystem();
+   return 0;
+}
+
+int file_load_calibration(char *buffer, unsigned int buffer_size) {
+   return file_load_cpld_file(CALIBRATION_FILE, buffer, buffer_size);
+}
+
+int file_save_calibration(char *buffer, unsigned int buffer_size) {
+   return file_save_cpld_file(CALIBRATION_FILE, buffer, buffer_size);
+}
+
+int file_load_genlock(char *buffer, unsigned int buffer_size) {
+   return file_load_cpld_file(GENLOCK_FILE, buffer, buffer_size);
+}
+
+int file_save_genlock(char *buffer, unsigned int buffer_size) {
+   return file_save_cpld_file(GENLOCK_FILE, buffer, buffer_size);
+}
+
+// Appends a record to the calibration log, starting a new log with header
+int file_append_cal_log(char *header, char *buffer, unsigned int buffer_size) {
+   FRESULT result;
+   char path[256];
+   FIL file;
+   unsigned int num_written = 0;
+   init_filesystem();
+
+   result = f_mkdir(CAPTURE_BASE);
+   if (result != FR_OK && result != FR_EXIST) {
+       log_warn("Failed to create dir %s (result = %d)", CAPTURE_BASE, result);
+   }
+   sprintf(path, "%s/%s", CAPTURE_BASE, CAL_LOG_FILE);
+
+   result = f_open(&file, path, FA_WRITE | FA_OPEN_APPEND);
+   if (result != FR_OK) {
+      log_warn("Failed to open %s (result = %d)", path, result);
+      close_filesystem();
+      return result;
+   }
+   if (f_size(&file) + buffer_size > CAL_LOG_MAX_SIZE) {
+      // Keep one previous log rather than letting it grow without limit
+      char old_path[256];
+      f_close(&file);
+      sprintf(old_path, "%s/%s.old", CAPTURE_BASE, CAL_LOG_FILE);
+      f_unlink(old_path);
+      result = f_rename(path, old_path);
+      if (result != FR_OK) {
+         log_warn("Failed to rename %s (result = %d)", path, result);
+      }
+      result = f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS);
+      if (result != FR_OK) {
+         log_warn("Failed to open %s (result = %d)", path, result);
+         close_filesystem();
+         return result;
+      }
+   }
+   if (f_size(&file) == 0) {
+      result = f_write(&file, header, strlen(header), &num_written);
+   }
+   if (result == FR_OK) {
+      result = f_write(&file, buffer, buffer_size, &num_written);
+   }
+   if (result != FR_OK) {
+      log_warn("Failed to write %s (result = %d)", path, result);
+      f_close(&file);
+      close_filesystem();
+      return result;
+   }
+   result = f_close(&file);
+   if (result != FR_OK) {
+      log_warn("Failed to close %s (result = %d)", path, result);
+      close_filesystem();
+      return result;
+   }
+   close_filesystem();
+   return 0;
+}
+
 int file_save_config(char *resolution_name, int scaling, int current_frontend) {
    FRESULT result;
    char path[256];
@@ -19,6 +19,11 @@ int file_save_config(char *resolution_name, int scaling, int current_frontend);
 int file_load(char *path, char *buffer, unsigned int buffer_size);
 int file_save(char *dirpath, char *name, char *buffer, unsigned int buffer_size);
 int file_restore(char *dirpath, char *name);
+int file_load_calibration(char *buffer, unsigned int buffer_size);
+int file_save_calibration(char *buffer, unsigned int buffer_size);
+int file_load_genlock(char *buffer, unsigned int buffer_size);
+int file_save_genlock(char *buffer, unsigned int buffer_size);
+int file_append_cal_log(char *header, char *buffer, unsigned int buffer_size);
 int create_and_scan_palettes(char names[MAX_NAMES][MAX_NAMES_WIDTH], uint32_t palette_array[MAX_NAMES][MAX_PALETTE_ENTRIES]);
 
 #endif
@@ -0,0 +1,58 @@
+#include "defs.h"
+#include "frc.h"
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void frc_init(frc_t *frc, unsigned int period, unsigned int guard) {
+   frc->period = period;
+   frc->guard = guard;
+   frc->valid = 0;
+   frc->vsync_count = 0;
+   frc->shown_valid = 0;
+   frc->presented = 0;
+   frc->repeated = 0;
+   frc->dropped = 0;
+}
+
+void frc_vsync(frc_t *frc, unsigned int time) {
+   if (frc->valid && frc->period != 0) {
+      // Count the vsyncs since the last one seen, as not all of them are seen
+      unsigned int elapsed = time - frc->vsync_time;
+      frc->vsync_count += (elapsed + (frc->period >> 1)) / frc->period;
+   }
+   frc->vsync_time = time;
+   frc->valid = 1;
+}
+
+unsigned int frc_schedule(frc_t *frc, unsigned int now) {
+   unsigned int elapsed = now - frc->vsync_time;
+   // After a long gap (the cycle counter wraps every few seconds) start again
+   if (!frc->valid || frc->period == 0 || elapsed / frc->period >= DISPLAY_VSYNC_MAX_PREDICT) {
+      frc->valid = 0;
+      frc->shown_valid = 0;
+      return 0;
+   }
+   unsigned int vsyncs = elapsed / frc->period + 1;
+   unsigned int until_vsync = frc->vsync_time + vsyncs * frc->period - now;
+   unsigned int wait = 0;
+   if (until_vsync < frc->guard) {
+      // Too close to be sure the flip makes it, so make sure it doesn't
+      wait = until_vsync + frc->guard;
+      vsyncs++;
+   }
+   unsigned int shown = frc->vsync_count + vsyncs;
+   if (frc->shown_valid) {
+      int vsyncs_shown = (int) (shown - frc->last_shown);
+      if (vsyncs_shown <= 0) {
+         frc->dropped++;
+      } else {
+         frc->repeated += vsyncs_shown - 1;
+      }
+   }
+   frc->presented++;
+   frc->last_shown = shown;
+   frc->shown_valid = 1;
+   return wait;
+}
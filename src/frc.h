@@ -0,0 +1,48 @@
+#ifndef FRC_H
+#define FRC_H
+
+// =============================================================
+// Frame rate conversion scheduler
+// =============================================================
+//
+// When the display isn't genlocked to the source, each captured frame is
+// flipped to as soon as it is complete and the GPU shows it from the next
+// display vsync. A frame completing just before a display vsync may or may
+// not make it, so the cadence (e.g. 5 frames over 6 vsyncs for 50Hz to 60Hz)
+// jitters. The scheduler predicts the display vsyncs from the last one seen
+// during capture and, if a flip would land within the guard time of one,
+// holds it back until that has passed. The capture carries on meanwhile,
+// and the flip is made from the vsync poll at the start of each line. Each
+// frame is then shown from the first display vsync at least the guard time
+// after it completes, which depends only on the timestamps, so the cadence
+// is deterministic.
+//
+// It also counts which display vsync each frame is first shown at, to
+// report frames that are repeated (shown for more than one vsync) and
+// dropped (replaced before they were shown).
+//
+// Times are in ARM cycles.
+
+typedef struct {
+   unsigned int period;        // display field period (0 = unknown)
+   unsigned int guard;
+   int valid;                  // vsync_time is known
+   unsigned int vsync_time;    // the last display vsync seen
+   unsigned int vsync_count;   // display vsyncs counted up to vsync_time
+   int shown_valid;            // last_shown is known
+   unsigned int last_shown;    // the display vsync the last frame is first shown at
+   unsigned int presented;
+   unsigned int repeated;      // extra vsyncs frames were shown for
+   unsigned int dropped;
+} frc_t;
+
+void frc_init(frc_t *frc, unsigned int period, unsigned int guard);
+
+// A display vsync was seen at time
+void frc_vsync(frc_t *frc, unsigned int time);
+
+// A frame is ready to flip at time now. Returns how long to hold the flip
+// back for (0 = flip now).
+unsigned int frc_schedule(frc_t *frc, unsigned int now);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <math.h>
+#include "defs.h"
+#include "genlock.h"
+
+static const int thresholds[GENLOCK_MAX_STEPS] = GENLOCK_THRESHOLDS;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+// Leaving the lock band by exactly the threshold counts as a resync, any further is an unlock
+static int check_lock(genlock_t *genlock, int difference) {
+   int threshold = thresholds[genlock->locked_threshold];
+   if (genlock->locked == 1 && abs(difference) >= threshold) {
+      genlock->locked = 0;
+      if (difference >= 0) {
+         genlock->target = -2;
+      } else {
+         genlock->target = 2;
+      }
+      if (abs(difference) > threshold) {
+         genlock->resync_count = 0;
+         genlock->target = 0;
+         return GENLOCK_UNLOCK;
+      }
+      if (genlock->resync_count >= 99) {
+         genlock->resync_count = 0;
+      }
+      genlock->resync_count++;
+      return GENLOCK_RESYNC;
+   }
+   return 0;
+}
+
+static int stepper_update(genlock_t *genlock, int difference, int force) {
+   int events = check_lock(genlock, difference);
+   int max_steps = genlock->max_steps;
+   int genlock_adjust = genlock->adjust;
+   int target_difference = genlock->target;
+   if (genlock->framecount == 0 && genlock->locked == 0) {
+      int new_genlock_adjust = genlock_adjust;
+      if (difference - target_difference == 0) {
+         if (genlock_adjust < 0) {
+            new_genlock_adjust++;
+         }
+         if (genlock_adjust > 0) {
+            new_genlock_adjust--;
+         }
+         if (new_genlock_adjust == 0)
+         {
+            genlock->locked = 1;
+            genlock->target = 0;
+            events |= GENLOCK_LOCKED;
+         }
+      } else {
+         if (difference >= target_difference) {
+            int threshold = 0;
+            if (genlock_adjust >= 0 && genlock_adjust < max_steps) {
+               threshold = thresholds[genlock_adjust];
+            }
+            if (genlock_adjust < max_steps && difference > threshold) {
+               new_genlock_adjust++;
+            }
+            if (genlock_adjust > 1 && difference <= thresholds[genlock_adjust - 1]) {
+               new_genlock_adjust--;
+            }
+         } else {
+            int threshold = 0;
+            if (genlock_adjust <= 0 && genlock_adjust > -max_steps) {
+               threshold = -thresholds[-genlock_adjust];
+            }
+            if (genlock_adjust > -max_steps && difference < threshold) {
+               new_genlock_adjust--;
+            }
+            if (genlock_adjust < -1 && difference >= -thresholds[-(genlock_adjust + 1)]) {
+               new_genlock_adjust++;
+            }
+         }
+      }
+      if (new_genlock_adjust != genlock_adjust || force) {
+         genlock->adjust = new_genlock_adjust;
+         genlock->framecount = genlock->frame_delay;
+         events |= GENLOCK_CHANGED;
+      }
+   }
+   return events;
+}
+
+// The loop is tuned for a double closed loop pole at 1 - 1/n, where n is
+// the time constant in fields. Each field the phase moves by lines * 1e-6
+// lines for each PPM of adjustment (= gain), so with
+//    adjustment = kp * difference + integral,  integral += ki * difference
+// the poles are the roots of z^2 - (2 - gain.kp).z + (1 - gain.kp + gain.ki),
+// giving kp = 2 / (n.gain) and ki = 1 / (n^2.gain).
+static int pi_update(genlock_t *genlock, int difference, int force) {
+   int events = check_lock(genlock, difference);
+   double n = (double) GENLOCK_PI_FIELDS * genlock->frame_delay / GENLOCK_FRAME_DELAY;
+   double gain = genlock->lines * 1e-6;
+   double kp = 2.0 / (n * gain);
+   double ki = 1.0 / (n * n * gain);
+   double max_ppm = genlock->max_steps * GENLOCK_PPM_STEP;
+
+   if (genlock->locked == 0) {
+      // When seeded the frequency is already right, so there's no need to wait for it to settle
+      int lock_fields = genlock->seeded ? GENLOCK_PI_SEEDED_LOCK_FIELDS : GENLOCK_PI_LOCK_FIELDS;
+      if (abs(difference) <= GENLOCK_PI_LOCK_LINES) {
+         if (++genlock->lock_count >= lock_fields) {
+            genlock->locked = 1;
+            genlock->lock_count = 0;
+            genlock->seeded = 0;
+            events |= GENLOCK_LOCKED;
+         }
+      } else {
+         genlock->lock_count = 0;
+      }
+   }
+
+   // Once locked, the vsync jitter within the deadband is ignored rather than chased
+   int error = difference;
+   if (genlock->locked) {
+      if (abs(error) <= GENLOCK_PI_DEADBAND_LINES) {
+         error = 0;
+      } else {
+         error -= (error > 0) ? GENLOCK_PI_DEADBAND_LINES : -GENLOCK_PI_DEADBAND_LINES;
+      }
+   }
+
+   double ppm = kp * error + genlock->integral;
+   // Only integrate while the adjustment isn't limited, so it doesn't wind up while slewing
+   if (ppm > max_ppm) {
+      ppm = max_ppm;
+   } else if (ppm < -max_ppm) {
+      ppm = -max_ppm;
+   } else {
+      genlock->integral += ki * error;
+   }
+   // Once locked, PLLH is written at most every GENLOCK_PI_WRITE_FIELDS fields
+   int ready = genlock->locked == 0 || genlock->framecount == 0;
+   if (force || (ready && fabs(ppm - genlock->ppm) >= GENLOCK_PI_MIN_CHANGE)) {
+      genlock->ppm = ppm;
+      genlock->framecount = GENLOCK_PI_WRITE_FIELDS;
+      events |= GENLOCK_CHANGED;
+   }
+   return events;
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void genlock_init(genlock_t *genlock, int controller) {
+   genlock->controller = controller;
+   genlock->integral = 0;
+   genlock->framecount = 0;
+   genlock_configure(genlock, GENLOCK_MAX_STEPS, GENLOCK_LOCKED_THRESHOLD, GENLOCK_FRAME_DELAY, 312);
+   genlock_reset(genlock);
+}
+
+void genlock_configure(genlock_t *genlock, int max_steps, int locked_threshold, int frame_delay, int lines) {
+   genlock->max_steps = max_steps;
+   genlock->locked_threshold = locked_threshold;
+   genlock->frame_delay = frame_delay;
+   genlock->lines = lines > 0 ? lines : 1;
+}
+
+void genlock_reset(genlock_t *genlock) {
+   genlock->locked = 0;
+   genlock->resync_count = 0;
+   genlock->target = 0;
+   genlock->adjust = 0;
+   genlock->lock_count = 0;
+   genlock->seeded = 0;
+   genlock->ppm = 0;
+}
+
+int genlock_seed(genlock_t *genlock, double integral) {
+   if (genlock->controller != GENLOCK_PI) {
+      return 0;
+   }
+   genlock->integral = integral;
+   genlock->seeded = 1;
+   genlock->lock_count = 0;
+   return 1;
+}
+
+int genlock_update(genlock_t *genlock, int difference, int force) {
+   if (genlock->controller == GENLOCK_PI) {
+      return pi_update(genlock, difference, force);
+   } else {
+      return stepper_update(genlock, difference, force);
+   }
+}
+
+void genlock_tick(genlock_t *genlock) {
+   if (genlock->framecount != 0) {
+      genlock->framecount--;
+   }
+}
+
+double genlock_ppm(genlock_t *genlock) {
+   if (genlock->controller == GENLOCK_PI) {
+      return genlock->ppm;
+   } else {
+      return genlock->adjust * GENLOCK_PPM_STEP;
+   }
+}
@@ -0,0 +1,78 @@
+#ifndef GENLOCK_H
+#define GENLOCK_H
+
+// =============================================================
+// Genlock controllers
+// =============================================================
+//
+// Decide how far to pull the HDMI clock away from the measured source
+// frequency so that the display vsync stays at a fixed line of the source
+// frame. Once per field they are given the phase difference in lines
+// (the line the display vsync was seen on, relative to where it should be)
+// and return the adjustment in PPM that recalculate_hdmi_clock applies.
+//
+// Two controllers are provided:
+//   GENLOCK_STEPPER is the original, which steps the adjustment through
+//                   GENLOCK_THRESHOLDS in units of GENLOCK_PPM_STEP
+//   GENLOCK_PI      is a proportional-integral controller with a
+//                   continuous adjustment (the PLLH fractional divider
+//                   resolution is well under 0.1 PPM). Once locked it
+//                   ignores differences within GENLOCK_PI_DEADBAND_LINES
+//                   and writes PLLH at most every GENLOCK_PI_WRITE_FIELDS
+//
+// The same code runs in the host simulator (scripts/genlock_sim.c).
+
+enum {
+   GENLOCK_STEPPER,
+   GENLOCK_PI
+};
+
+// Events returned by genlock_update
+#define GENLOCK_CHANGED 1   // the adjustment has changed, so the HDMI clock must be recalculated
+#define GENLOCK_LOCKED  2   // lock acquired
+#define GENLOCK_RESYNC  4   // drifted out of the lock band, pulling back in
+#define GENLOCK_UNLOCK  8   // drifted too far, lock lost
+
+typedef struct {
+   int controller;
+   // Settings, from the genlock speed
+   int max_steps;          // largest adjustment, in GENLOCK_PPM_STEP units
+   int locked_threshold;   // index into GENLOCK_THRESHOLDS of the lock band
+   int frame_delay;        // stepper: fields between steps; PI: scales the time constant
+   int lines;              // lines per field, in the units of the difference
+   // State
+   int locked;
+   int resync_count;
+   int target;             // stepper: the difference it is steering towards
+   int framecount;         // fields until the next step (stepper) or PLLH write (PI), decremented by genlock_tick
+   int adjust;             // stepper: the adjustment, in GENLOCK_PPM_STEP units
+   int lock_count;         // PI: consecutive fields within the lock band
+   int seeded;             // PI: the integral term came from genlock_seed and hasn't locked yet
+   double integral;        // PI: the integral term (the estimated frequency error), in PPM
+   double ppm;             // PI: the adjustment
+} genlock_t;
+
+void genlock_init(genlock_t *genlock, int controller);
+
+void genlock_configure(genlock_t *genlock, int max_steps, int locked_threshold, int frame_delay, int lines);
+
+// Clears the lock state and the adjustment (but keeps the PI integral term)
+void genlock_reset(genlock_t *genlock);
+
+// Starts the PI controller from a previously converged integral term (the
+// frequency error of the source measurement, in PPM), so it only has to pull
+// in the phase and can declare lock after GENLOCK_PI_SEEDED_LOCK_FIELDS.
+// Returns 0 if the controller has no use for it.
+int genlock_seed(genlock_t *genlock, double integral);
+
+// Runs the controller for one field, force = recalculate the clock even if
+// the adjustment doesn't change. Returns GENLOCK_* event bits.
+int genlock_update(genlock_t *genlock, int difference, int force);
+
+// Called once per field whether or not genlock_update was called
+void genlock_tick(genlock_t *genlock);
+
+// The current adjustment in PPM (positive slows the display down)
+double genlock_ppm(genlock_t *genlock);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "defs.h"
+#include "cpld.h"
+#include "logging.h"
+#include "filesystem.h"
+#include "genlock_cache.h"
+
+// Each line of the file is one entry:
+// profile,sub_profile,lines_per_frame,source_vsync_freq
+
+typedef struct {
+   genlock_cache_key_t key;
+   double source_vsync_freq;
+} genlock_cache_entry_t;
+
+static genlock_cache_entry_t entries[GENLOCK_CACHE_MAX_ENTRIES];
+static int num_entries = 0;
+
+// The CPLD design the entries were loaded for
+static cpld_t *loaded_cpld = NULL;
+
+// Set when an entry has changed by enough to be worth writing to the SD card
+static int dirty = 0;
+
+static char buffer[GENLOCK_CACHE_BUFFER_SIZE];
+
+// =============================================================
+// Private methods
+// =============================================================
+
+static genlock_cache_entry_t *find_entry(genlock_cache_key_t *key) {
+   for (int i = 0; i < num_entries; i++) {
+      genlock_cache_key_t *entry_key = &entries[i].key;
+      if (strcmp(entry_key->profile, key->profile) == 0 && strcmp(entry_key->sub_profile, key->sub_profile) == 0
+          && entry_key->lines_per_frame == key->lines_per_frame) {
+         return &entries[i];
+      }
+   }
+   return NULL;
+}
+
+// Copies the next comma separated field of *line into field
+static int next_field(char **line, char *field, int size) {
+   char *end = strchr(*line, ',');
+   int len = end ? end - *line : strlen(*line);
+   if (len >= size) {
+      return 0;
+   }
+   strncpy(field, *line, len);
+   field[len] = 0;
+   *line += end ? len + 1 : len;
+   return 1;
+}
+
+static int parse_entry(char *line, genlock_cache_entry_t *entry) {
+   genlock_cache_key_t *key = &entry->key;
+   if (!next_field(&line, key->profile, sizeof(key->profile)) || !next_field(&line, key->sub_profile, sizeof(key->sub_profile))) {
+      return 0;
+   }
+   return sscanf(line, "%d,%lf", &key->lines_per_frame, &entry->source_vsync_freq) == 2 && entry->source_vsync_freq > 0;
+}
+
+static void load_cache() {
+   loaded_cpld = cpld;
+   num_entries = 0;
+   dirty = 0;
+   int bytes = file_load_genlock(buffer, sizeof(buffer) - 1);
+   char *line = buffer;
+   while (bytes > 0 && *line && num_entries < GENLOCK_CACHE_MAX_ENTRIES) {
+      char *eol = strpbrk(line, "\r\n");
+      if (eol) {
+         *eol++ = 0;
+      }
+      if (parse_entry(line, &entries[num_entries])) {
+         num_entries++;
+      }
+      if (!eol) {
+         break;
+      }
+      line = eol + strspn(eol, "\r\n");
+   }
+   log_info("Genlock cache: %d entries for %s", num_entries, cpld->name);
+}
+
+static void save_cache() {
+   char *pointer = buffer;
+   char *end = buffer + sizeof(buffer);
+   for (int i = 0; i < num_entries; i++) {
+      genlock_cache_key_t *key = &entries[i].key;
+      if (end - pointer < 2 * MAX_PROFILE_WIDTH + 64) {
+         break;
+      }
+      pointer += sprintf(pointer, "%s,%s,%d,%.6lf\r\n", key->profile, key->sub_profile, key->lines_per_frame, entries[i].source_vsync_freq);
+   }
+   file_save_genlock(buffer, pointer - buffer);
+   dirty = 0;
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+double genlock_cache_lookup(genlock_cache_key_t *key) {
+   genlock_cache_entry_t *entry = find_entry(key);
+   return entry ? entry->source_vsync_freq : 0;
+}
+
+void genlock_cache_store(genlock_cache_key_t *key, double source_vsync_freq) {
+   genlock_cache_entry_t *entry = find_entry(key);
+   if (entry == NULL) {
+      if (num_entries < GENLOCK_CACHE_MAX_ENTRIES) {
+         entry = &entries[num_entries++];
+      } else {
+         // Full, so drop the oldest entry
+         memmove(&entries[0], &entries[1], (GENLOCK_CACHE_MAX_ENTRIES - 1) * sizeof(genlock_cache_entry_t));
+         entry = &entries[GENLOCK_CACHE_MAX_ENTRIES - 1];
+      }
+      memcpy(&entry->key, key, sizeof(genlock_cache_key_t));
+      dirty = 1;
+   } else if (fabs(source_vsync_freq / entry->source_vsync_freq - 1.0) * 1e6 >= GENLOCK_CACHE_SAVE_PPM) {
+      dirty = 1;
+   }
+   entry->source_vsync_freq = source_vsync_freq;
+}
+
+void genlock_cache_sync() {
+   if (loaded_cpld != cpld) {
+      load_cache();
+   } else if (dirty) {
+      log_info("Genlock cache: saving %d entries", num_entries);
+      save_cache();
+   }
+}
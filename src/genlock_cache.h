@@ -0,0 +1,34 @@
+#ifndef GENLOCK_CACHE_H
+#define GENLOCK_CACHE_H
+
+#include "defs.h"
+
+// =============================================================
+// Genlock cache
+// =============================================================
+//
+// Remembers the source field rate that genlock converged to for each
+// profile, so that on returning to it the controller can start from the
+// right HDMI clock rather than from the (less accurate) measured rate, and
+// only has to pull in the phase.
+//
+// There is one file per CPLD design, in Saved_Profiles next to the
+// calibration cache. It is read by genlock_cache_sync, lookups and stores
+// only touch RAM so they can be used from the per field genlock update.
+
+typedef struct {
+   char profile[MAX_PROFILE_WIDTH];
+   char sub_profile[MAX_PROFILE_WIDTH];   // empty if the profile has no sub profiles
+   int lines_per_frame;
+} genlock_cache_key_t;
+
+// Returns the source field rate in Hz genlock converged to for key, or 0 if there isn't one
+double genlock_cache_lookup(genlock_cache_key_t *key);
+
+// Records the source field rate genlock has converged to for key
+void genlock_cache_store(genlock_cache_key_t *key, double source_vsync_freq);
+
+// Loads the cache when the CPLD design changes and saves any changes to the SD card
+void genlock_cache_sync();
+
+#endif
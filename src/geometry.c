@@ -64,7 +64,7 @@ static param_t params[] = {
    {    H_ASPECT,     "H Pixel Aspect",           "h_aspect",         0,          8, 1 },
    {    V_ASPECT,     "V Pixel Aspect",           "v_aspect",         0,          8, 1 },
    {   FB_SIZEX2,            "FB Size",            "fb_size",         0,          3, 1 },
-   {      FB_BPP,      "FB Bits/Pixel",      "fb_bits_pixel",         4,          8, 4 },
+   {      FB_BPP,      "FB Bits/Pixel",      "fb_bits_pixel",         4,         16, 4 },
    {       CLOCK,    "Clock Frequency",    "clock_frequency",   1000000,   40000000, 1000 },
    {    LINE_LEN,        "Line Length",        "line_length",       100,       5000, 1 },
    {   CLOCK_PPM,    "Clock Tolerance",    "clock_tolerance",         0,     100000, 100 },
@@ -291,6 +291,10 @@ void geometry_set_value(int num, int value) {
       geometry->fb_sizex2 = value;
       break;
    case FB_BPP:
+      // There's no 12bpp mode, so step over it in the direction of travel
+      if (value == 12) {
+         value = (geometry->fb_bpp < 12) ? 16 : 8;
+      }
       geometry->fb_bpp = value;
       break;
    case CLOCK:
@@ -377,6 +381,21 @@ void geometry_get_fb_params(capture_info_t *capinfo) {
     capinfo->vsync_type     = geometry->vsync_type;
     capinfo->video_type     = geometry->video_type;
     capinfo->sizex2 = geometry->fb_sizex2;
+    // Mode 7 is captured by a 4bpp palette based function only
+    if (capinfo->video_type == VIDEO_TELETEXT && capinfo->bpp == 16) {
+        capinfo->bpp = 4;
+    }
+#ifndef MULTI_BUFFER
+    // The 16bpp OSD is overwritten by each captured field, so it needs a
+    // separate draw buffer to be redrawn in before it is shown
+    if (capinfo->bpp == 16) {
+        capinfo->bpp = 8;
+    }
+#endif
+    // There's no double width 16bpp capture function
+    if (capinfo->bpp == 16) {
+        capinfo->sizex2 &= 1;
+    }
 #ifdef INHIBIT_DOUBLE_HEIGHT
     if (capinfo->video_type != VIDEO_TELETEXT) {
         capinfo->sizex2 &= 2;
@@ -0,0 +1,247 @@
+#include "defs.h"
+#include "mode7_ref.h"
+#include "osd.h"
+
+// Pixel bits of a captured word, the remaining bits are OSD (or motion flags)
+#define PIXEL_MASK 0x77777777
+
+// =============================================================
+// Private methods
+// =============================================================
+
+// The red vsync indicator and the debug markers
+static uint32_t vsync_marker(uint32_t flags) {
+   uint32_t marker = (flags & BIT_VSYNC_MARKER) ? 0x11111111 : 0;
+   if (flags & BIT_DEBUG) {
+      marker ^= 0x02000050;  // magenta in leftmost, green in rightmost
+   }
+   return marker;
+}
+
+// The other field is the line below in even fields and the line above in odd fields
+static int other_field_offset(int pitch, uint32_t flags) {
+   return (flags & BIT_FIELD_TYPE) ? pitch : -pitch;
+}
+
+// Converts the 12 pixels of the first character of a group to one bit per pixel
+// (set if not the background colour of the two leftmost pixels), ignoring the
+// leftmost three pixels and the rightmost pixel
+static int char1_bits(uint32_t left, uint32_t middle) {
+   uint32_t bg = left & 0x77;
+   uint32_t x = left ^ (bg << 8) ^ (bg << 16) ^ (bg << 24);
+   int bits = 0;
+   if (x & 0x00000700) bits |= 0x01;
+   if (x & 0x00700000) bits |= 0x02;
+   if (x & 0x00070000) bits |= 0x04;
+   if (x & 0x70000000) bits |= 0x08;
+   if (x & 0x07000000) bits |= 0x10;
+   x = middle ^ bg ^ (bg << 8);
+   if (x & 0x00000070) bits |= 0x20;
+   if (x & 0x00000007) bits |= 0x40;
+   if (x & 0x00007000) bits |= 0x80;
+   return bits;
+}
+
+// As char1_bits for the second character (top half of middle plus right)
+static int char2_bits(uint32_t middle, uint32_t right) {
+   uint32_t bg = middle & 0x770000;
+   uint32_t x = middle ^ (bg << 8);
+   int bits = 0;
+   if (x & 0x07000000) bits |= 0x01;
+   x = right ^ (bg >> 16) ^ (bg >> 8) ^ bg ^ (bg << 8);
+   if (x & 0x00000070) bits |= 0x02;
+   if (x & 0x00000007) bits |= 0x04;
+   if (x & 0x00007000) bits |= 0x08;
+   if (x & 0x00000700) bits |= 0x10;
+   if (x & 0x00700000) bits |= 0x20;
+   if (x & 0x00070000) bits |= 0x40;
+   if (x & 0x70000000) bits |= 0x80;
+   return bits;
+}
+
+// Returns 1 if the two lines of a character look like a rounded (character
+// smoothed) pair rather than motion, in which case the character isn't deinterlaced
+static int is_rounding_pair(int bits, int other_bits, int charline, uint32_t flags, const uint8_t *rounding_lookup) {
+   if (!(flags & BIT_FIELD_TYPE)) {
+      int tmp = bits;
+      bits = other_bits;
+      other_bits = tmp;
+   }
+   int pair = charline - 1;
+   if (pair < 0) {
+      return 0;
+   }
+   // Exceptions that save 7K of lookup table
+   if ((pair == 2 || pair == 5) && bits == 0x81 && other_bits == 0xc3) {
+      return 1;
+   }
+   if ((other_bits == 0x7f || other_bits == 0x9e || other_bits == 0xfe) && bits == 0xff && pair == 6) {
+      return 1;
+   }
+   const uint8_t *table = rounding_lookup + (pair << 9) + bits;
+   if (table[0] == 0) {
+      return 0;
+   }
+   if (table[0] == other_bits) {
+      return 1;
+   }
+   if (table[0x100] == 0) {
+      return 0;
+   }
+   return table[0x100] == other_bits;
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+uint32_t mode7_ref_capture_word(uint32_t first, uint32_t second) {
+   uint32_t word;
+   // Pixels 0..3 -> bits 7..4, 3..0, 15..12, 11..8
+   word  = (first & (7 << PIXEL_BASE))       << (4 - PIXEL_BASE);
+   word |= (first & (7 << (PIXEL_BASE + 3))) >> (3 + PIXEL_BASE);
+   word |= (first & (7 << (PIXEL_BASE + 6))) << (6 - PIXEL_BASE);
+   word |= (first & (7 << (PIXEL_BASE + 9))) >> (1 + PIXEL_BASE);
+   // Pixels 4..7 -> bits 23..20, 19..16, 31..28, 27..24
+   word |= (second & (7 << PIXEL_BASE))       << (20 - PIXEL_BASE);
+   word |= (second & (7 << (PIXEL_BASE + 3))) << (13 - PIXEL_BASE);
+   word |= (second & (7 << (PIXEL_BASE + 6))) << (22 - PIXEL_BASE);
+   word |= (second & (7 << (PIXEL_BASE + 9))) << (15 - PIXEL_BASE);
+   return word;
+}
+
+void mode7_ref_line(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t *cmp, int pitch, uint32_t flags, int charline, const uint8_t *rounding_lookup) {
+   int setting = (flags & MASK_INTERLACE) >> OFFSET_INTERLACE;
+   if ((flags & BIT_CALIBRATE) || setting == DEINTERLACE_NONE) {
+      mode7_ref_none(capture, nwords, fb, flags);
+   } else if (setting == DEINTERLACE_BOB) {
+      mode7_ref_bob(capture, nwords, fb, pitch, flags);
+   } else if (setting >= DEINTERLACE_ADV) {
+      // The motion map only skips decisions that would come out the same
+      mode7_ref_advanced(capture, nwords, fb, cmp, pitch, flags, charline, rounding_lookup);
+   } else {
+      mode7_ref_motion(capture, nwords, fb, cmp, pitch, flags);
+   }
+}
+
+void mode7_ref_none(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t flags) {
+   uint32_t marker = vsync_marker(flags);
+   for (int i = 0; i < nwords; i++) {
+      fb[i] = (capture[i] ^ marker) | (fb[i] & ~PIXEL_MASK);
+   }
+}
+
+void mode7_ref_bob(const uint32_t *capture, int nwords, uint32_t *fb, int pitch, uint32_t flags) {
+   uint32_t marker = vsync_marker(flags);
+#ifdef USE_ALT_DEINTERLACE_CODE
+   int osd = 1;
+#else
+   int osd = flags & BIT_OSD;
+#endif
+   for (int i = 0; i < nwords; i++) {
+      uint32_t value = capture[i] ^ marker;
+      uint32_t old_other = osd ? fb[i + pitch] : 0;
+      uint32_t old = osd ? fb[i] : 0;
+      fb[i + pitch] = (old_other & ~PIXEL_MASK) | value;
+      fb[i] = value | (old & ~PIXEL_MASK);
+   }
+}
+
+void mode7_ref_motion(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t *cmp, int pitch, uint32_t flags) {
+   uint32_t marker = vsync_marker(flags);
+   int setting = (flags & MASK_INTERLACE) >> OFFSET_INTERLACE;
+   int other = other_field_offset(pitch, flags);
+#ifdef USE_ALT_DEINTERLACE_CODE
+   int osd = 1;
+#else
+   int osd = flags & BIT_OSD;
+#endif
+   for (int i = 0; i < nwords; i++) {
+      uint32_t old = osd ? fb[i] : 0;
+      uint32_t old_other = osd ? fb[i + other] : 0;
+      uint32_t old_cmp = cmp[i];
+      uint32_t value = capture[i];
+      // Motion flags: bit 31 = this field, bit 23 = other field, bit 15 and bit 7 = the previous two
+      if (cmp[i + other] & 0x80000000) {
+         value |= 0x00800000;
+      }
+      if ((value ^ old_cmp) & PIXEL_MASK) {
+         value |= 0x80000000;
+      }
+      if (old_cmp & 0x80000000) {
+         value |= 0x00008000;
+      }
+      if (old_cmp & 0x00800000) {
+         value |= 0x00000080;
+      }
+      cmp[i] = value;
+      // Higher settings look further back for motion
+      if (setting <= DEINTERLACE_MA3) {
+         value &= ~0x00000080;
+      }
+      if (setting <= DEINTERLACE_MA2) {
+         value &= ~0x00008000;
+      }
+      if (setting <= DEINTERLACE_MA1) {
+         value &= ~0x00800000;
+      }
+      uint32_t motion = value & ~PIXEL_MASK;
+      value &= PIXEL_MASK;
+      if (motion) {
+         fb[i + other] = (old_other & ~PIXEL_MASK) | value;
+      }
+      fb[i] = (value | (old & ~PIXEL_MASK)) ^ marker;
+   }
+}
+
+void mode7_ref_advanced(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t *cmp, int pitch, uint32_t flags, int charline, const uint8_t *rounding_lookup) {
+   uint32_t marker = vsync_marker(flags);
+   int other = other_field_offset(pitch, flags);
+   int osd = flags & BIT_OSD;
+   // Each group of three words is two 12 pixel characters
+   for (int n = nwords; n > 0; n -= 3) {
+      uint32_t *fbo = fb + other;
+      uint32_t *cmpo = cmp + other;
+      uint32_t left = capture[0];
+      uint32_t middle = capture[1];
+      uint32_t right = capture[2];
+
+      // OSD bits from both fields of the screen
+      uint32_t osd0 = osd ? fb[0] & ~PIXEL_MASK : 0;
+      uint32_t osd1 = osd ? fb[1] & ~PIXEL_MASK : 0;
+      uint32_t osd2 = osd ? fb[2] & ~PIXEL_MASK : 0;
+      uint32_t other_osd0 = osd ? fbo[0] & ~PIXEL_MASK : 0;
+      uint32_t other_word1 = fbo[1];  // keeps its pixels as half of it may be written back
+      uint32_t other_osd2 = osd ? fbo[2] & ~PIXEL_MASK : 0;
+
+      // This field always gets the new values
+      cmp[0] = left;
+      fb[0] = (osd0 ^ marker) | left;
+      cmp[1] = middle;
+      fb[1] = (osd1 ^ marker) | middle;
+
+      // First character: deinterlace unless it looks like a rounded character
+      int deinterlace = ((left ^ cmpo[0]) & 0x00007000) || ((middle ^ cmpo[1]) & 0x00000700)
+                        || !is_rounding_pair(char1_bits(left, middle), char1_bits(cmpo[0], cmpo[1]), charline, flags, rounding_lookup);
+      if (deinterlace) {
+         fbo[0] = other_osd0 | left;
+         other_word1 = (other_word1 & ~0x00007777) | (middle & 0xffff);
+         fbo[1] = other_word1;
+      }
+
+      cmp[2] = right;
+      fb[2] = (osd2 ^ marker) | right;
+
+      // Second character
+      deinterlace = ((middle ^ cmpo[1]) & 0x70000000) || ((right ^ cmpo[2]) & 0x07000000)
+                    || !is_rounding_pair(char2_bits(middle, right), char2_bits(cmpo[1], cmpo[2]), charline, flags, rounding_lookup);
+      if (deinterlace) {
+         fbo[1] = (other_word1 & ~0x77770000) | (middle & ~0xffff);
+         fbo[2] = other_osd2 | right;
+      }
+
+      capture += 3;
+      fb += 3;
+      cmp += 3;
+   }
+}
@@ -0,0 +1,46 @@
+#ifndef MODE7_REF_H
+#define MODE7_REF_H
+
+#include <inttypes.h>
+
+// =============================================================
+// Reference Mode 7 deinterlacers
+// =============================================================
+//
+// C versions of the deinterlacers in capture_line_mode7_4bpp.S, written to
+// produce exactly the same frame buffer and comparison buffer contents as
+// the assembler for the same captured words. They are the starting point
+// for trying out cheaper algorithms and for checking what any change gives up.
+//
+// In a BENCHMARK build, benchmark_mode7_reference times them against the
+// assembler and selfcheck_mode7_reference checks they give the same results
+// on live fields. scripts/capture_replay.c does the same check on the host,
+// running the assembler under unicorn on a synthetic teletext signal.
+//
+// All functions process one line:
+//   capture  = the captured words (8 pixels per word, as CAPTURE_LOW_BITS/CAPTURE_HIGH_BITS)
+//   nwords   = number of words to process (=param_chars_per_line)
+//   fb       = the line in the frame buffer
+//   cmp      = the same line in the comparison buffer
+//   pitch    = frame buffer line pitch in words
+//   flags    = the flags register as passed to the capture line function
+//   charline = scan line count modulo 10 (only used by the advanced deinterlacer)
+//   rounding_lookup = the table from capture_line_mode7_4bpp.S (only used by the advanced deinterlacer)
+
+// Converts the GPLEV0 values from two consecutive psync edges to a captured word
+uint32_t mode7_ref_capture_word(uint32_t gplev0_first, uint32_t gplev0_second);
+
+// Dispatches on the deinterlace setting in flags, as capture_line_mode7_4bpp does
+void mode7_ref_line(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t *cmp, int pitch, uint32_t flags, int charline, const uint8_t *rounding_lookup);
+
+void mode7_ref_none(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t flags);
+
+void mode7_ref_bob(const uint32_t *capture, int nwords, uint32_t *fb, int pitch, uint32_t flags);
+
+// Simple motion adaptive deinterlace (DEINTERLACE_MA1 to DEINTERLACE_MA4)
+void mode7_ref_motion(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t *cmp, int pitch, uint32_t flags);
+
+// Advanced deinterlace (DEINTERLACE_ADV and DEINTERLACE_ADV_MAP), processes whole groups of two characters (three words)
+void mode7_ref_advanced(const uint32_t *capture, int nwords, uint32_t *fb, uint32_t *cmp, int pitch, uint32_t flags, int charline, const uint8_t *rounding_lookup);
+
+#endif
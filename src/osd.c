@@ -129,7 +129,8 @@ static const char *deinterlace_names[] = {
    "Simple Motion 2",
    "Simple Motion 3",
    "Simple Motion 4",
-   "Advanced Motion"
+   "Advanced Motion",
+   "Advanced Motion Map"
 };
 
 #ifdef MULTI_BUFFER
@@ -250,6 +251,9 @@ enum {
    F_VLOCKADJ,
 #ifdef MULTI_BUFFER
    F_NBUFFERS,
+#endif
+#ifdef FRAME_RATE_CONVERSION
+   F_RATECONVERT,
 #endif
    F_RETURN,
    F_DEBUG
@@ -264,7 +268,7 @@ static param_t features[] = {
    {      F_SUBPROFILE,       "Sub-Profile",        "subprofile", 0,                    0, 1 },
    {         F_PALETTE,           "Palette",           "palette", 0,                    0, 1 },
    {  F_PALETTECONTROL,   "Palette Control",   "palette_control", 0,     NUM_CONTROLS - 1, 1 },
-   {     F_DEINTERLACE,"Teletext Deinterlace", "teletext_deinterlace", 0, NUM_DEINTERLACES - 1, 1 },
+   {     F_DEINTERLACE,"Deinterlace", "teletext_deinterlace", 0, NUM_DEINTERLACES - 1, 1 },
    {       F_M7SCALING,  "Teletext Scaling",     "teletext_scaling", 0,   NUM_ESCALINGS - 1, 1 },
    {   F_NORMALSCALING,"Progressive Scaling",    "progressive_scaling", 0, NUM_ESCALINGS - 1, 1 },
    {          F_COLOUR,     "Output Colour",     "output_colour", 0,      NUM_COLOURS - 1, 1 },
@@ -282,6 +286,9 @@ static param_t features[] = {
    {        F_VLOCKADJ,    "Genlock Adjust",    "genlock_adjust", 0,     NUM_VLOCKADJ - 2, 1 },  //-2 so disables 260 mhz for now
 #ifdef MULTI_BUFFER
    {        F_NBUFFERS,       "Num Buffers",       "num_buffers", 0,                    3, 1 },
+#endif
+#ifdef FRAME_RATE_CONVERSION
+   {     F_RATECONVERT,      "Rate Convert",      "rate_convert", 0,                    1, 1 },
 #endif
    {          F_RETURN,   "Return Position",            "return", 0,                    1, 1 },
    {           F_DEBUG,             "Debug",             "debug", 0,                    1, 1 },
@@ -348,6 +355,13 @@ static void info_cal_summary(int line);
 static void info_cal_detail(int line);
 static void info_cal_raw(int line);
 static void info_credits(int line);
+#ifdef USE_JITTER_COMPENSATION
+static void info_jitter(int line);
+#endif
+static void info_motion_map(int line);
+#ifdef USE_CAL_MONITOR
+static void info_cal_monitor(int line);
+#endif
 static void info_reboot(int line);
 
 static void rebuild_geometry_menu(menu_t *menu);
@@ -360,6 +374,13 @@ static info_menu_item_t cal_summary_ref      = { I_INFO, "Calibration Summary",
 static info_menu_item_t cal_detail_ref       = { I_INFO, "Calibration Detail",  info_cal_detail};
 static info_menu_item_t cal_raw_ref          = { I_INFO, "Calibration Raw",     info_cal_raw};
 static info_menu_item_t credits_ref          = { I_INFO, "Credits",             info_credits};
+#ifdef USE_JITTER_COMPENSATION
+static info_menu_item_t jitter_ref           = { I_INFO, "Line Jitter",         info_jitter};
+#endif
+static info_menu_item_t motion_map_ref       = { I_INFO, "Motion Map",          info_motion_map};
+#ifdef USE_CAL_MONITOR
+static info_menu_item_t cal_monitor_ref      = { I_INFO, "Calibration Monitor", info_cal_monitor};
+#endif
 static info_menu_item_t reboot_ref           = { I_INFO, "Reboot",              info_reboot};
 
 static back_menu_item_t back_ref             = { I_BACK, "Return"};
@@ -419,6 +440,13 @@ static menu_t info_menu = {
       (base_menu_item_t *) &cal_summary_ref,
       (base_menu_item_t *) &cal_detail_ref,
       (base_menu_item_t *) &cal_raw_ref,
+#ifdef USE_CAL_MONITOR
+      (base_menu_item_t *) &cal_monitor_ref,
+#endif
+#ifdef USE_JITTER_COMPENSATION
+      (base_menu_item_t *) &jitter_ref,
+#endif
+      (base_menu_item_t *) &motion_map_ref,
       (base_menu_item_t *) &credits_ref,
       (base_menu_item_t *) &reboot_ref,
       (base_menu_item_t *) &update_cpld_menu_ref,
@@ -452,6 +480,9 @@ static param_menu_item_t vlockadj_ref        = { I_FEATURE, &features[F_VLOCKADJ
 #ifdef MULTI_BUFFER
 static param_menu_item_t nbuffers_ref        = { I_FEATURE, &features[F_NBUFFERS]       };
 #endif
+#ifdef FRAME_RATE_CONVERSION
+static param_menu_item_t rateconvert_ref     = { I_FEATURE, &features[F_RATECONVERT]    };
+#endif
 static param_menu_item_t autoswitch_ref      = { I_FEATURE, &features[F_AUTOSWITCH]     };
 static param_menu_item_t return_ref          = { I_FEATURE, &features[F_RETURN]         };
 static param_menu_item_t debug_ref           = { I_FEATURE, &features[F_DEBUG]          };
@@ -489,6 +520,9 @@ static menu_t settings_menu = {
       (base_menu_item_t *) &vlockspeed_ref,
       (base_menu_item_t *) &vlockadj_ref,
       (base_menu_item_t *) &nbuffers_ref,
+#ifdef FRAME_RATE_CONVERSION
+      (base_menu_item_t *) &rateconvert_ref,
+#endif
       (base_menu_item_t *) &return_ref,
       (base_menu_item_t *) &debug_ref,
       NULL
@@ -840,6 +874,10 @@ static int get_feature(int num) {
 #ifdef MULTI_BUFFER
    case F_NBUFFERS:
       return get_nbuffers();
+#endif
+#ifdef FRAME_RATE_CONVERSION
+   case F_RATECONVERT:
+      return get_rateconvert();
 #endif
    case F_AUTOSWITCH:
       return get_autoswitch();
@@ -946,6 +984,11 @@ static void set_feature(int num, int value) {
    case F_NBUFFERS:
       set_nbuffers(value);
       break;
+#endif
+#ifdef FRAME_RATE_CONVERSION
+   case F_RATECONVERT:
+      set_rateconvert(value);
+      break;
 #endif
    case F_RETURN:
       return_at_end = value;
@@ -1058,6 +1101,11 @@ static const char *get_param_string(param_menu_item_t *param_item) {
       case F_AUTOSWITCH:
          return autoswitch_names[value];
       case F_DEINTERLACE:
+         // Outside Mode 7 the motion adaptive settings all select the same
+         // capture line functions, so they are shown as one setting
+         if (!geometry_get_mode() && value >= DEINTERLACE_MA1) {
+            return "Motion Adaptive";
+         }
          return deinterlace_names[value];
       case F_M7SCALING:
          return even_scaling_names[value];
@@ -1146,8 +1194,73 @@ static void info_system_summary(int line) {
    osd_set(line++, 0, message);
    sprintf(message, "  SDRAM_I Voltage: %6.2f V", get_voltage(COMPONENT_SDRAM_I));
    osd_set(line++, 0, message);
+#ifdef USE_LINE_SKIP
+   // Lines that weren't copied to screen memory because they were unchanged
+   sprintf(message, "  Unchanged Lines: %u/%u", lines_skipped, lines_flushed);
+   osd_set(line++, 0, message);
+#endif
+}
+
+#ifdef USE_JITTER_COMPENSATION
+static void info_jitter(int line) {
+   // Histogram of the error of each line's hsync against the line timing model
+   int cpuspeed = get_clock_rate(ARM_CLK_ID) / 1000000;
+   int half = JITTER_BINS / 2;
+   sprintf(message, "Edge: %d cycles, Resyncs: %u", jitter_edge_cycles, jitter_resyncs);
+   osd_set(line++, 0, message);
+   osd_set(line++, 0, "Error(ns)    Lines  Error(ns)    Lines");
+   for (int i = 0; i < half; i++) {
+      int ns0 = ((i - half) << JITTER_BIN_SHIFT) * 1000 / cpuspeed;
+      int ns1 = (i << JITTER_BIN_SHIFT) * 1000 / cpuspeed;
+      sprintf(message, "%+9d %8u  %+9d %8u", ns0, jitter_histogram[i], ns1, jitter_histogram[i + half]);
+      osd_set(line++, 0, message);
+   }
+}
+#endif
+
+static void info_motion_map(int line) {
+   // Totals for the last field captured with the Advanced Motion Map deinterlace
+   unsigned int decided = motion_map_field_decided;
+   unsigned int reused = motion_map_field_reused;
+   unsigned int cycles = motion_map_field_cycles;
+   int cpuspeed = get_clock_rate(ARM_CLK_ID) / 1000000;
+   if (get_feature(F_DEINTERLACE) != DEINTERLACE_ADV_MAP) {
+      osd_set(line++, 0, "Deinterlace is not Advanced Motion Map");
+   }
+   sprintf(message, "Characters checked: %u", decided);
+   osd_set(line++, 0, message);
+   sprintf(message, "Decisions reused: %u", reused);
+   osd_set(line++, 0, message);
+   if (decided) {
+      // Each reused decision saves the measured cost of a full decision
+      unsigned int cost = cycles / decided;
+      unsigned int saving = reused * cost;
+      sprintf(message, "Cycles per decision: %u", cost);
+      osd_set(line++, 0, message);
+      sprintf(message, "Saving per field: %u cycles (%u us)", saving, saving / cpuspeed);
+      osd_set(line++, 0, message);
+   }
 }
 
+#ifdef USE_CAL_MONITOR
+static void info_cal_monitor(int line) {
+   sprintf(message, "Measurements: %u", cal_monitor.measurements);
+   osd_set(line++, 0, message);
+   sprintf(message, "Drift events: %u (last %s)", cal_monitor.drift_events,
+           cal_monitor.last_drift < 0 ? "left" : cal_monitor.last_drift > 0 ? "right" : "none");
+   osd_set(line++, 0, message);
+   if (cal_monitor.metric < 0) {
+      sprintf(message, "Errors per frame: unknown");
+   } else {
+      sprintf(message, "Errors per frame: %d", (cal_monitor.metric + 8) >> 4);
+   }
+   osd_set(line++, 0, message);
+   sprintf(message, "Errors lean to: %s (%d frames)",
+           cal_monitor.last_lean < 0 ? "left edge" : cal_monitor.last_lean > 0 ? "right edge" : "neither edge", cal_monitor.consistent);
+   osd_set(line++, 0, message);
+}
+#endif
+
 static void info_credits(int line) {
    osd_set(line++, 0, "Many thanks to our main developers:");
    osd_set(line++, 0, "- David Banks (hoglet)");
@@ -1382,7 +1495,10 @@ void yuv2rgb(int maxdesat, int mindesat, int luma_scale, int black_ref, int y1_m
 
 
 uint32_t osd_get_equivalence(uint32_t value) {
-   if (capinfo->bpp == 8) {
+   if (capinfo->bpp == 16) {
+        // direct colour, equivalent colours are already the same value
+        return value;
+   } else if (capinfo->bpp == 8) {
         return equivalence[value & 0xff] | (equivalence[(value >> 8) & 0xff] << 8) | (equivalence[(value >> 16) & 0xff] << 16) | (equivalence[value >> 24] << 24);
    } else {
         return equivalence[value & 0xf] | (equivalence[(value >> 4) & 0xf] << 4) | (equivalence[(value >> 8) & 0xf] << 8) | (equivalence[(value >> 12) & 0xf] << 12)
@@ -2269,7 +2385,7 @@ void osd_update_palette() {
     int g = 0;
     int b = 0;
     int m = 0;
-    int num_colours = (capinfo->bpp == 8) ? 256 : 16;
+    int num_colours = (capinfo->bpp == 16) ? 64 : (capinfo->bpp == 8) ? 256 : 16;
     int design_type = (cpld->get_version() >> VERSION_DESIGN_BIT) & 0x0F;
 
     //copy selected palette to current palette, translating for Atom cpld and inverted Y setting (required for 6847 direct Y connection)
@@ -2364,14 +2480,14 @@ void osd_update_palette() {
              }
         }
         if (active) {
-            if (i >= (num_colours >> 1)) {
+            if (i >= (num_colours >> 1) && capinfo->bpp != 16) {
             palette_data[i] = 0xFFFFFFFF;
             } else {
             r >>= 1; g >>= 1; b >>= 1;
             palette_data[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
             }
         } else {
-            if ((i >= (num_colours >> 1)) && get_feature(F_SCANLINES)) {
+            if ((i >= (num_colours >> 1)) && get_feature(F_SCANLINES) && capinfo->bpp != 16) {
                 int scanline_intensity = get_feature(F_SCANLINESINT) ;
                 r = (r * scanline_intensity)>>4;
                 g = (g * scanline_intensity)>>4;
@@ -2385,6 +2501,24 @@ void osd_update_palette() {
             palette_data[i] |= 0x00101010;
         }
    }
+   if (capinfo->bpp == 16) {
+      // Direct colour so there's no palette to set, instead build the RGB565 lookup used by the
+      // capture line functions, with the scanline colour for doubled lines in the high half
+      int scanline_intensity = get_feature(F_SCANLINES) ? get_feature(F_SCANLINESINT) : 16;
+      for (int i = 0; i < num_colours; i++) {
+         r = palette_data[i] & 0xff;
+         g = (palette_data[i] >> 8) & 0xff;
+         b = (palette_data[i] >> 16) & 0xff;
+         uint32_t colour = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+         r = (r * scanline_intensity) >> 4;
+         g = (g * scanline_intensity) >> 4;
+         b = (b * scanline_intensity) >> 4;
+         uint32_t scanline_colour = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+         capture_lut_16bpp[i] = colour | (scanline_colour << 16);
+         capture_lut_16bpp[i + 64] = colour | (colour << 16);
+      }
+      return;
+   }
    RPI_PropertyInit();
    RPI_PropertyAddTag(TAG_SET_PALETTE, num_colours, palette_data);
    RPI_PropertyProcess();
@@ -2743,6 +2877,14 @@ int sub_profiles_available(int profile_number) {
    return has_sub_profiles[profile_number];
 }
 
+const char *get_profile_name(int profile_number) {
+   return profile_names[profile_number];
+}
+
+const char *get_sub_profile_name(int profile_number, int sub_profile_number) {
+   return has_sub_profiles[profile_number] ? sub_profile_names[sub_profile_number] : "";
+}
+
 int autoswitch_detect(int one_line_time_ns, int lines_per_frame, int sync_type) {
    if (has_sub_profiles[get_feature(F_PROFILE)]) {
       log_info("Looking for autoswitch match = %d, %d, %d", one_line_time_ns, lines_per_frame, sync_type);
@@ -3234,6 +3376,10 @@ int osd_key(int key) {
          if (val > param_item->param->max) {
             val = param_item->param->min;
          }
+         // Skip the motion adaptive settings that would show the same (see get_param_string)
+         if (type == I_FEATURE && param_item->param->key == F_DEINTERLACE && !geometry_get_mode() && val > DEINTERLACE_MA1) {
+            val = (key == key_value_dec) ? DEINTERLACE_MA1 : DEINTERLACE_NONE;
+         }
          set_param(param_item, val);
          if (type == I_GEOMETRY) {
             switch(param_item->param->key) {
@@ -3575,10 +3721,61 @@ void osd_init() {
    }
 }
 
+// At 16bpp there are no spare palette bits, so the OSD text is written
+// directly in white and the background is dimmed by the capture lookup.
+// Each captured field overwrites the text, so rgb_to_fb redraws it into
+// the draw buffer after every field, before flipping to it. The OSD is
+// always multi buffered for this (16bpp needs MULTI_BUFFER, see
+// geometry_get_fb_params). The vsync marker and the debug colours
+// aren't shown at 16bpp as the capture lookup has no bits for them.
+
+static void osd_update_16bpp(uint32_t *osd_base, int bytes_per_line) {
+   int bufferCharWidth = capinfo->width / 12;         // SAA5050 character data is 12x20
+   int pixels_per_line = bytes_per_line >> 1;
+   uint16_t *line_ptr = (uint16_t *) osd_base;
+   int use1220font = ((capinfo->sizex2 & 1) && capinfo->nlines > FONT_THRESHOLD * 10) && (bufferCharWidth >= LINELEN) && (get_feature(F_FONTSIZE) == FONTSIZE_12X20_8);
+   int font_width = use1220font ? 12 : 8;
+   int font_height = use1220font ? 20 : 8;
+
+   for (int line = 0; line <= osd_hwm; line++) {
+      int attr = attributes[line];
+      int scale = (attr & ATTR_DOUBLE_SIZE) ? 2 : 1;
+      int len = LINELEN / scale;
+      for (int y = 0; y < font_height; y++) {
+         uint16_t *pixel_ptr = line_ptr;
+         for (int i = 0; i < len; i++) {
+            int c = buffer[line * LINELEN + i];
+            // Deal with unprintable characters
+            if (c < 32 || c > 127) {
+               c = 32;
+            }
+            int data = use1220font ? (fontdata[32 * c + y] & 0x3ff) : (int) fontdata8[8 * c + y];
+            // The left most pixel is the highest bit
+            for (int j = font_width - 1; j >= 0; j--) {
+               if (data & (1 << j)) {
+                  for (int k = 0; k < scale; k++) {
+                     pixel_ptr[k] = 0xFFFF;
+                     if (scale == 2) {
+                        pixel_ptr[k + pixels_per_line] = 0xFFFF;
+                     }
+                  }
+               }
+               pixel_ptr += scale;
+            }
+         }
+         line_ptr += pixels_per_line * scale;
+      }
+   }
+}
+
 void osd_update(uint32_t *osd_base, int bytes_per_line) {
    if (!active) {
       return;
    }
+   if (capinfo->bpp == 16) {
+      osd_update_16bpp(osd_base, bytes_per_line);
+      return;
+   }
    // SAA5050 character data is 12x20
    int bufferCharWidth = capinfo->width / 12;         // SAA5050 character data is 12x20
 
@@ -3770,6 +3967,10 @@ void osd_update_fast(uint32_t *osd_base, int bytes_per_line) {
    if (!active) {
       return;
    }
+   if (capinfo->bpp == 16) {
+      osd_update_16bpp(osd_base, bytes_per_line);
+      return;
+   }
    // SAA5050 character data is 12x20
    int bufferCharWidth = capinfo->width / 12;         // SAA5050 character data is 12x20
 
@@ -1,6 +1,8 @@
 #ifndef OSD_H
 #define OSD_H
 
+#include <stdint.h>
+
 #define OSD_SW1     1
 #define OSD_SW2     2
 #define OSD_SW3     3
@@ -12,6 +14,7 @@
 
 extern int clock_error_ppm;
 extern int customPalette[];
+extern uint32_t capture_lut_16bpp[];
 extern char paletteHighNibble[];
 extern int paletteFlags;
 
@@ -109,6 +112,7 @@ enum {
    DEINTERLACE_MA3,
    DEINTERLACE_MA4,
    DEINTERLACE_ADV,
+   DEINTERLACE_ADV_MAP,
    NUM_DEINTERLACES
 };
 
@@ -176,6 +180,8 @@ void process_single_profile(char *buffer);
 uint32_t osd_get_palette(int index);
 int autoswitch_detect(int one_line_time_ns, int lines_per_frame, int sync_type);
 int sub_profiles_available();
+const char *get_profile_name(int profile_number);
+const char *get_sub_profile_name(int profile_number, int sub_profile_number);
 uint32_t osd_get_equivalence(uint32_t value);
 int get_existing_frontend(int frontend);
 
@@ -45,10 +45,23 @@ extern int capture_line_half_even_6bpp_table();
 
 extern int vsync_line;
 extern int total_lines;
+#ifdef TIME_DISPLAY_VSYNC
+extern unsigned int display_vsync_time;
+#endif
+#ifdef FRAME_RATE_CONVERSION
+extern int pending_flip_buffer;
+extern unsigned int pending_flip_time;
+#endif
+#ifdef INSTRUMENT_LATENCY
+extern unsigned int latency_start_time;
+extern unsigned int last_hsync_time;
+#endif
 extern int lock_fail;
 
 extern int elk_mode;
 
+extern int field_type;
+
 extern int hsync_period;
 extern int vsync_period;
 extern int hsync_comparison_lo;
@@ -73,12 +86,60 @@ extern int line_timeout;
 
 extern int dummyscreen;
 
+extern int capture_address;
+
+extern int line_staging;
+
+extern uint8_t rounding_lookup[];
+
+extern unsigned int motion_map_field_decided;
+extern unsigned int motion_map_field_reused;
+extern unsigned int motion_map_field_cycles;
+
+#ifdef USE_LINE_SKIP
+extern unsigned int lines_skipped;
+extern unsigned int lines_flushed;
+#endif
+
+#ifdef USE_JITTER_COMPENSATION
+extern int jitter_edge_cycles;
+extern int jitter_period;
+extern unsigned int jitter_resyncs;
+extern unsigned int jitter_histogram[];
+#endif
+
+#ifdef USE_CAL_MONITOR
+typedef struct {
+   int metric;                 // smoothed errors per frame (x16) at the current offsets (-1 = unknown)
+   int consistent;             // frames in a row the errors leaned to the same edge of the pixels
+   int last_lean;              // edge the errors leaned to in the last frame (-1 = left, 1 = right, 0 = neither)
+   int direction;              // offset step that samples later (corrected if a move makes things worse)
+   unsigned int measurements;
+   unsigned int drift_events;
+   int last_drift;             // direction of the last move (0 = none yet)
+} cal_monitor_t;
+
+extern cal_monitor_t cal_monitor;
+
+void cal_monitor_field(int flags);
+#endif
+
 int recalculate_hdmi_clock_line_locked_update();
 
+#ifdef USE_CLOCK_TRACKER
+void clock_tracker_update();
+#endif
+
 void osd_update_palette();
 
 void delay_in_arm_cycles(int delay);
 
 int benchmarkRAM(int address);
 
+#ifdef INSTRUMENT_CAPTURE
+extern unsigned int capture_line_cycles[];
+extern unsigned int capture_line_active_cycles[];
+void instrument_capture_field();
+#endif
+
 #endif
@@ -23,6 +23,12 @@
 #include "geometry.h"
 #include "filesystem.h"
 #include "rgb_to_fb.h"
+#include "mode7_ref.h"
+#include "cal_cache.h"
+#include "cal_log.h"
+#include "genlock.h"
+#include "genlock_cache.h"
+#include "frc.h"
 
 // #define INSTRUMENT_CAL
 #define NUM_CAL_PASSES 1
@@ -164,10 +170,23 @@ static void cpld_init();
 
 cpld_t *cpld = NULL;
 int clock_error_ppm = 0;
+#ifdef CAL_LOG
+// Time taken by the last calibrate_sampling_clock
+static unsigned int clock_time_us = 0;
+// Result of the last diff_N_frames (the final test of a calibration)
+static int last_diff_errors = -1;
+#endif
 int vsync_time_ns = 0;
 capture_info_t *capinfo;
 clk_info_t clkinfo;
 
+#ifdef INSTRUMENT_CAPTURE
+// Cycles spent in the capture line function for each line of the current field (written by rgb_to_fb.S)
+unsigned int capture_line_cycles[INSTRUMENT_CAPTURE_MAX_LINES];
+// As above, but measured from the end of hsync (so excludes waiting for hsync)
+unsigned int capture_line_active_cycles[INSTRUMENT_CAPTURE_MAX_LINES];
+#endif
+
 // =============================================================
 // Local variables
 // =============================================================
@@ -181,9 +200,7 @@ static int interlaced;
 static int clear;
 static volatile int delay;
 static double pllh_clock = 0;
-static int genlocked = 0;
-static int resync_count = 0;
-static int target_difference = 0;
+static genlock_t genlock;
 static int source_vsync_freq_hz = 0;
 static int display_vsync_freq_hz = 0;
 static double source_vsync_freq = 0;
@@ -258,8 +275,10 @@ static const char *mixed_names[] = {
 // Calculated so that the constants from librpitx work
 static volatile uint32_t *gpioreg = (volatile uint32_t *)(PERIPHERAL_BASE + 0x101000UL);
 
+#ifndef MULTI_BUFFER
 // Temporary buffer that must be at least as large as a frame buffer
 static unsigned char last[2048 * 1024] __attribute__((aligned(32)));
+#endif
 
 #ifndef USE_PROPERTY_INTERFACE_FOR_FB
 typedef struct {
@@ -705,9 +724,58 @@ void set_pll_frequency(double f, int pll_ctrl, int pll_fract) {
    }
 }
 
+#ifdef USE_CLOCK_TRACKER
+// =============================================================
+// Sampling clock tracker
+// =============================================================
+//
+// calibrate_sampling_clock only measures 100 lines. While capturing, the
+// tracker times whole frames (pairs of consecutive fields, so interlaced
+// fields of different lengths average out) over CLOCK_TRACKER_FRAMES frames,
+// and re-trims the sampling PLL so it follows a source whose crystal drifts
+// as it warms up. The PLL is only rewritten once CLOCK_TRACKER_CONFIRM
+// measurements in a row are out by more than CLOCK_TRACKER_MIN_TRIM in the
+// same direction, and not within CLOCK_TRACKER_HOLDOFF measurements of the
+// last write, so a noisy source doesn't keep moving it.
+
+static int tracker_enabled = 0;           // the clock was set from the measured error
+static int tracker_frame_lines = 0;       // lines in a pair of fields
+static double tracker_frame_cycles = 0;   // expected length of a pair of fields, in ARM cycles
+static double tracker_pll_freq = 0;       // the sampling PLL frequency currently set
+static unsigned int tracker_gpclk_divisor = 0;
+static int tracker_pending = 0;           // the length of the first field of a pair, or 0
+static double tracker_sum = 0;
+static int tracker_frames = 0;
+static int tracker_rejects = 0;
+static int tracker_trims = 0;
+static int tracker_trimmed = 0;           // the PLL has moved since calibrate_sampling_clock set it
+static int tracker_confirm = 0;           // consecutive measurements calling for a trim (negative if down)
+static int tracker_holdoff = 0;           // measurements left before the PLL may be written again
+static double tracked_ppm = 0;
+
+static void clock_tracker_reset(int enabled, double pll_freq, unsigned int gpclk_divisor, double lines_per_frame_double) {
+   tracker_enabled = enabled;
+   tracker_pll_freq = pll_freq;
+   tracker_gpclk_divisor = gpclk_divisor;
+   tracker_frame_lines = (int) (lines_per_frame_double + 0.5);
+   tracker_frame_cycles = (double) vsync_time_ns * cpuspeed / 1000;
+   tracker_pending = 0;
+   tracker_sum = 0;
+   tracker_frames = 0;
+   tracker_rejects = 0;
+   tracker_trims = 0;
+   tracker_trimmed = 0;
+   tracker_confirm = 0;
+   tracker_holdoff = CLOCK_TRACKER_HOLDOFF;
+   tracked_ppm = clock_error_ppm;
+}
+#endif
 
 static int calibrate_sampling_clock(int profile_changed) {
    int a = 13;
+#ifdef CAL_LOG
+   unsigned int start_time = cal_log_now();
+#endif
    static unsigned int old_pll_freq = 0;
    static unsigned int old_clock = 0;
    // Default values for the Beeb
@@ -737,6 +805,9 @@ static int calibrate_sampling_clock(int profile_changed) {
    log_info("          Clock error = %d PPM", clock_error_ppm);
 
    unsigned int new_clock;
+#ifdef USE_CLOCK_TRACKER
+   int track = 0;
+#endif
     if (profile_changed) {
         old_clock = clkinfo.clock * cpld->get_divider();
     }
@@ -755,6 +826,9 @@ static int calibrate_sampling_clock(int profile_changed) {
       }
    } else {
       new_clock = (unsigned int) (((double)  clkinfo.clock * cpld->get_divider()) / error);
+#ifdef USE_CLOCK_TRACKER
+      track = 1;
+#endif
    }
 
    old_clock = new_clock;
@@ -787,6 +861,13 @@ static int calibrate_sampling_clock(int profile_changed) {
    log_info(" Actual PLL frequency = %u Hz", pll_freq);
    log_info("        GPCLK Divisor = %u", gpclk_divisor);
 
+#ifdef USE_CLOCK_TRACKER
+   // The tracker may have moved the PLL away from old_pll_freq
+   if (tracker_trimmed) {
+      old_pll_freq = 0;
+   }
+#endif
+
    // If the clock has changed from it's previous value, then actually change it
    if (pll_freq != old_pll_freq) {
 
@@ -853,10 +934,88 @@ static int calibrate_sampling_clock(int profile_changed) {
    // Invalidate the current vlock mode to force an updated, as vsync_time_ns will have changed
    current_vlockmode = -1;
 
+#ifdef USE_CLOCK_TRACKER
+   clock_tracker_reset(track, pll_freq, gpclk_divisor, lines_per_frame_double);
+#endif
+
+#ifdef CAL_LOG
+   clock_time_us = cal_log_now() - start_time;
+#endif
    return a;
 }
 
-static void recalculate_hdmi_clock(int vlockmode, int genlock_adjust) {
+#ifdef USE_CLOCK_TRACKER
+static void clock_tracker_trim() {
+#ifndef USE_PLLC
+   // As in calibrate_sampling_clock, a large error means the profile doesn't match the source
+   if (!tracker_enabled || (clkinfo.clock_ppm > 0 && fabs(tracked_ppm) > clkinfo.clock_ppm)) {
+      return;
+   }
+   double new_clock = (double) clkinfo.clock * cpld->get_divider() / (1.0 + tracked_ppm / 1000000);
+   double pll_freq = new_clock * gpioreg[PER] * tracker_gpclk_divisor;
+   double trim_ppm = (pll_freq / tracker_pll_freq - 1.0) * 1000000;
+   if (fabs(trim_ppm) < CLOCK_TRACKER_MIN_TRIM || pll_freq < MIN_PLL_FREQ || pll_freq > MAX_PLL_FREQ) {
+      tracker_confirm = 0;
+      return;
+   }
+   // Hysteresis: the error must persist in the same direction
+   if ((trim_ppm > 0) != (tracker_confirm > 0)) {
+      tracker_confirm = 0;
+   }
+   tracker_confirm += (trim_ppm > 0) ? 1 : -1;
+   if (abs(tracker_confirm) < CLOCK_TRACKER_CONFIRM || tracker_holdoff > 0) {
+      return;
+   }
+   unsigned int prediv = (gpioreg[ANA1] >> 14) & 1;
+   set_pll_frequency(pll_freq / (1 << prediv) / 1e6, PLL_CTRL, PLL_FRAC);
+   tracker_pll_freq = pll_freq;
+   tracker_trimmed = 1;
+   tracker_confirm = 0;
+   tracker_holdoff = CLOCK_TRACKER_HOLDOFF;
+   tracker_trims++;
+   adjusted_clock = (int) (new_clock / cpld->get_divider() + 0.5);
+   log_info("Clock tracker: error = %.2lf PPM, trimmed by %.2lf PPM", tracked_ppm, trim_ppm);
+#endif
+}
+
+// Called from rgb_to_fb once per captured field
+void clock_tracker_update() {
+   if (!sync_detected || tracker_frame_lines == 0) {
+      tracker_pending = 0;
+      return;
+   }
+   if (tracker_pending == 0) {
+      tracker_pending = vsync_period;
+      return;
+   }
+   double frame_cycles = (double) tracker_pending + (double) vsync_period;
+   tracker_pending = 0;
+   // Reject frames with dropped fields or sync glitches
+   if (fabs(frame_cycles / tracker_frame_cycles - 1.0) * 1000000 > CLOCK_TRACKER_REJECT_PPM) {
+      tracker_rejects++;
+      return;
+   }
+   tracker_sum += frame_cycles;
+   if (++tracker_frames < CLOCK_TRACKER_FRAMES) {
+      return;
+   }
+   // Follow the drift, so the outlier window stays centred
+   tracker_frame_cycles = tracker_sum / tracker_frames;
+   double line_ns = tracker_frame_cycles * 1000 / cpuspeed / tracker_frame_lines;
+   double nominal_line_ns = 1e9 * ((double) clkinfo.line_len) / ((double) clkinfo.clock);
+   tracked_ppm = (line_ns / nominal_line_ns - 1.0) * 1000000;
+   log_debug("Clock tracker: %d frames, %d rejected, error = %.2lf PPM", tracker_frames, tracker_rejects, tracked_ppm);
+   tracker_sum = 0;
+   tracker_frames = 0;
+   tracker_rejects = 0;
+   if (tracker_holdoff > 0) {
+      tracker_holdoff--;
+   }
+   clock_tracker_trim();
+}
+#endif
+
+static void recalculate_hdmi_clock(int vlockmode, double genlock_ppm) {
    // The very first time we get called, vsync_time_ns has not been set
    // so exit gracefully
    if (vsync_time_ns == 0) {
@@ -923,7 +1082,7 @@ static void recalculate_hdmi_clock(int vlockmode, int genlock_adjust) {
 
    if (vlockmode != HDMI_ORIGINAL) {
       f2 /= error;
-      f2 /= 1.0 + ((double) (genlock_adjust * GENLOCK_PPM_STEP) / 1000000);
+      f2 /= 1.0 + genlock_ppm / 1000000;
    }
 
    // Sanity check HDMI pixel clock
@@ -967,14 +1126,47 @@ static void recalculate_hdmi_clock(int vlockmode, int genlock_adjust) {
    //log_pllh();
 }
 
+#ifdef GENLOCK_CACHE
+static void get_genlock_cache_key(genlock_cache_key_t *key) {
+   strncpy(key->profile, get_profile_name(profile), sizeof(key->profile) - 1);
+   key->profile[sizeof(key->profile) - 1] = 0;
+   strncpy(key->sub_profile, get_sub_profile_name(profile, subprofile), sizeof(key->sub_profile) - 1);
+   key->sub_profile[sizeof(key->sub_profile) - 1] = 0;
+   key->lines_per_frame = lines_per_frame;
+}
+
+// Starts the controller from the source field rate it converged to last time,
+// the integral term being the error in the measured rate
+static void seed_genlock() {
+   genlock_cache_key_t key;
+   get_genlock_cache_key(&key);
+   double cached_vsync_freq = genlock_cache_lookup(&key);
+   if (cached_vsync_freq > 0 && vsync_time_ns != 0) {
+      double error_ppm = (2e9 / ((double) vsync_time_ns) / cached_vsync_freq - 1.0) * 1000000;
+      if (fabs(error_ppm) <= GENLOCK_CACHE_TOLERANCE && genlock_seed(&genlock, error_ppm)) {
+         log_info("Genlock cache: seeded at %.1lf PPM", error_ppm);
+      }
+   }
+}
+
+// Records the source field rate the controller has converged to
+static void store_genlock() {
+   if (genlock.controller == GENLOCK_PI && vsync_time_ns != 0) {
+      genlock_cache_key_t key;
+      get_genlock_cache_key(&key);
+      genlock_cache_store(&key, 2e9 / ((double) vsync_time_ns) / (1.0 + genlock.integral / 1000000));
+   }
+}
+#endif
+
 int recalculate_hdmi_clock_line_locked_update(int force) {
-    static int framecount = 0;
-    static int genlock_adjust = 0;
     static int last_vlock = -1;
-    static int thresholds[GENLOCK_MAX_STEPS] = GENLOCK_THRESHOLDS;
+#ifdef GENLOCK_CACHE
+    static int cache_fields = 0;
+#endif
     if (force) {
         last_vlock = 0x80000000;
-        genlocked = 0;
+        genlock.locked = 0;
         return 0;
     }
     lock_fail = 0;
@@ -984,28 +1176,25 @@ int recalculate_hdmi_clock_line_locked_update(int force) {
             adjustment = 1;
         }
         if (vlockmode != HDMI_EXACT) {
-            genlocked = 0;
-            target_difference = 0;
-            resync_count = 0;
-            genlock_adjust = 0;
+            genlock_reset(&genlock);
             switch (vlockmode) {
                 case HDMI_SLOW_2000PPM:
-                    genlock_adjust = 6;
+                    genlock.adjust = 6;
                     break;
                 case HDMI_SLOW_1000PPM:
-                    genlock_adjust = 3;
+                    genlock.adjust = 3;
                     break;
                 case HDMI_FAST_1000PPM:
-                    genlock_adjust = -3;
+                    genlock.adjust = -3;
                     break;
                 case HDMI_FAST_2000PPM:
-                    genlock_adjust = -6;
+                    genlock.adjust = -6;
                     break;
             }
             if (last_vlock != vlockmode) {
-                recalculate_hdmi_clock(vlockmode, genlock_adjust);
+                recalculate_hdmi_clock(vlockmode, genlock.adjust * GENLOCK_PPM_STEP);
                 last_vlock = vlockmode;
-                framecount = 0;
+                genlock.framecount = 0;
             }
         } else {
             int max_steps = GENLOCK_MAX_STEPS;
@@ -1022,91 +1211,49 @@ int recalculate_hdmi_clock_line_locked_update(int force) {
                     frame_delay <<= 1;
                 }
             }
+            genlock_configure(&genlock, max_steps, locked_threshold, frame_delay, total_lines >> adjustment);
             signed int difference = (vsync_line >> adjustment) - ((total_lines >> adjustment) - vlockline);
             if (abs(difference) > (total_lines >> (adjustment + 1))) {
                 difference = -difference;
             }
-            if (genlocked == 1 && abs(difference) >= thresholds[locked_threshold]) {
-                genlocked = 0;
-                if (difference >= 0) {
-                    target_difference = -2;
-                } else {
-                    target_difference = 2;
-                }
-                if (abs(difference) > thresholds[locked_threshold]) {
-                    log_info("UnLock");
-                    resync_count = 0;
-                    target_difference = 0;
-                    lock_fail = 1;
-                } else {
-                    log_info("Sync%02d", ++resync_count);
-                    if (resync_count >= 99) {
-                        resync_count = 0;
-                    }
-                }
+#ifdef GENLOCK_CACHE
+            if (last_vlock != HDMI_EXACT) {
+                seed_genlock();
             }
-            if(framecount == 0) {
-                int new_genlock_adjust = genlock_adjust;
-                if (genlocked == 0) {
-                    if (difference - target_difference == 0) {
-                        if (genlock_adjust < 0) {
-                            new_genlock_adjust++;
-                        }
-                        if (genlock_adjust > 0) {
-                            new_genlock_adjust--;
-                        }
-                        if (new_genlock_adjust == 0)
-                        {
-                            genlocked = 1;
-                            target_difference = 0;
-                            log_info("Locked");
-                        }
-                    } else {
-                        if (difference >= target_difference) {
-                            int threshold = 0;
-                            if (genlock_adjust >= 0 && genlock_adjust < max_steps) {
-                                threshold = thresholds[genlock_adjust];
-                            }
-                            if (genlock_adjust < max_steps && difference > threshold) {
-                                new_genlock_adjust++;
-                            }
-                            if (genlock_adjust > 1 && difference <= thresholds[genlock_adjust - 1]) {
-                                new_genlock_adjust--;
-                            }
-                        } else {
-                            int threshold = 0;
-                            if (genlock_adjust <= 0 && genlock_adjust > -max_steps) {
-                                threshold = -thresholds[-genlock_adjust];
-                            }
-                            if (genlock_adjust > -max_steps && difference < threshold) {
-                                new_genlock_adjust--;
-                            }
-                            if (genlock_adjust < -1 && difference >= -thresholds[-(genlock_adjust + 1)]) {
-                                new_genlock_adjust++;
-                            }
-                        }
-                    }
-                    if (new_genlock_adjust != genlock_adjust || last_vlock != HDMI_EXACT) {
-                        recalculate_hdmi_clock(HDMI_EXACT, new_genlock_adjust);
-                        last_vlock = HDMI_EXACT;
-                        genlock_adjust = new_genlock_adjust;
-                        framecount = frame_delay;
-                        //log_debug("%4d,%4d,%4d,%4d,%4d,%4d", genlocked, vlockline, vsync_line, difference, thresholds[abs(genlock_adjust)], genlock_adjust);
-                    }
-                }
+#endif
+            int events = genlock_update(&genlock, difference, last_vlock != HDMI_EXACT);
+            if (events & GENLOCK_UNLOCK) {
+                log_info("UnLock");
+                lock_fail = 1;
+            }
+            if (events & GENLOCK_RESYNC) {
+                log_info("Sync%02d", genlock.resync_count);
+            }
+            if (events & GENLOCK_LOCKED) {
+                log_info("Locked");
+            }
+#ifdef GENLOCK_CACHE
+            // Keep the cache up to date as the estimate improves while locked
+            if (genlock.locked && ((events & GENLOCK_LOCKED) || ++cache_fields >= GENLOCK_CACHE_UPDATE_FIELDS)) {
+                store_genlock();
+                cache_fields = 0;
+            }
+#endif
+            if (events & GENLOCK_CHANGED) {
+                recalculate_hdmi_clock(HDMI_EXACT, genlock_ppm(&genlock));
+                last_vlock = HDMI_EXACT;
+                //log_debug("%4d,%4d,%4d,%4d,%8.2lf", genlock.locked, vlockline, vsync_line, difference, genlock_ppm(&genlock));
             }
         }
     }
-    if (framecount != 0) {
-      framecount --;
-    }
+    genlock_tick(&genlock);
     if (vlockmode != HDMI_EXACT) {
       // Return 0 if genlock disabled
       return 0;
     } else {
       // Return 1 if genlock enabled but not yet locked
       // Return 2 if genlock enabled and locked
-      return 1 + genlocked;
+      return 1 + genlock.locked;
     }
 }
 
@@ -1363,7 +1510,12 @@ return extra;
 #ifdef HAS_MULTICORE
 static void start_core(int core, func_ptr func) {
    printf("starting core %d\r\n", core);
+   // Write the start address to the core's mailbox 3 in the ARM local peripherals
+#if defined(RPI4)
+   *(unsigned int *)(0xff80008c + 0x10 * core) = (unsigned int) func;
+#else
    *(unsigned int *)(0x4000008c + 0x10 * core) = (unsigned int) func;
+#endif
    asm  ( "sev" );
 }
 #endif
@@ -1372,6 +1524,393 @@ static void start_core(int core, func_ptr func) {
 // Public methods
 // =============================================================
 
+#ifdef INSTRUMENT_CAPTURE
+static unsigned int instrument_worst[INSTRUMENT_CAPTURE_MAX_LINES];
+static unsigned int instrument_total[INSTRUMENT_CAPTURE_MAX_LINES];
+static unsigned int instrument_active_worst[INSTRUMENT_CAPTURE_MAX_LINES];
+static unsigned int instrument_active_total[INSTRUMENT_CAPTURE_MAX_LINES];
+static int instrument_fields = 0;
+static int instrument_nlines = -1;
+static int instrument_capture_address = 0;
+static int instrument_quiet = 0;
+
+static void instrument_capture_reset() {
+   for (int i = 0; i < INSTRUMENT_CAPTURE_MAX_LINES; i++) {
+      instrument_worst[i] = 0;
+      instrument_total[i] = 0;
+      instrument_active_worst[i] = 0;
+      instrument_active_total[i] = 0;
+   }
+   instrument_fields = 0;
+}
+
+// Nominal number of psync edges waited for in each line
+// (h_offset edges skipped, then two edges per psync cycle, doubled at 6bpp)
+static int instrument_capture_edges() {
+   int edges = (capinfo->h_offset << capinfo->sample_width) + 1 + (capinfo->chars_per_line << (capinfo->sample_width + 1));
+   return edges < 1 ? 1 : edges;
+}
+
+// Mean and worst active cycles per psync edge over all lines accumulated so far
+static void instrument_capture_summary(double *mean, double *worst) {
+   int edges = instrument_capture_edges();
+   double total = 0;
+   unsigned int max = 0;
+   for (int i = 0; i < instrument_nlines; i++) {
+      total += instrument_active_total[i];
+      if (instrument_active_worst[i] > max) {
+         max = instrument_active_worst[i];
+      }
+   }
+   *mean = (instrument_fields && instrument_nlines > 0) ? total / instrument_fields / instrument_nlines / edges : 0;
+   *worst = (double)max / edges;
+}
+
+static void instrument_capture_report() {
+   int edges = instrument_capture_edges();
+   unsigned int line_worst = 0;
+   double line_mean = 0;
+   log_info("Capture instrumentation: function=%08x, fields=%d, lines=%d, psync edges/line=%d, cpu=%dMHz",
+            capture_address, instrument_fields, instrument_nlines, edges, cpuspeed);
+   log_info("Line     Mean    Worst  ActMean ActWorst  Edge(Mean) Edge(Worst)");
+   for (int i = 0; i < instrument_nlines; i++) {
+      double mean = (double)instrument_total[i] / instrument_fields;
+      double active_mean = (double)instrument_active_total[i] / instrument_fields;
+      log_info("%4d %8d %8u %8d %8u %11.1f %11.1f", i, (int)mean, instrument_worst[i], (int)active_mean, instrument_active_worst[i],
+               active_mean / edges, (double)instrument_active_worst[i] / edges);
+      line_mean += mean;
+      if (instrument_worst[i] > line_worst) {
+         line_worst = instrument_worst[i];
+      }
+   }
+   if (instrument_nlines > 0) {
+      line_mean /= instrument_nlines;
+   }
+   double edge_mean;
+   double edge_worst;
+   instrument_capture_summary(&edge_mean, &edge_worst);
+   log_info("All lines: mean=%d worst=%u cycles/line", (int)line_mean, line_worst);
+   log_info("All lines: mean=%.1f worst=%.1f cycles/psync edge (%.1f ns/edge mean)",
+            edge_mean, edge_worst, edge_mean * 1000 / cpuspeed);
+}
+
+// Called from rgb_to_fb.S at the end of each field's active lines
+void instrument_capture_field() {
+   int nlines = capinfo->nlines;
+   if (nlines > INSTRUMENT_CAPTURE_MAX_LINES) {
+      nlines = INSTRUMENT_CAPTURE_MAX_LINES;
+   }
+   // Start again if the capture function or geometry has changed
+   if (nlines != instrument_nlines || capture_address != instrument_capture_address) {
+      instrument_capture_reset();
+      instrument_nlines = nlines;
+      instrument_capture_address = capture_address;
+   }
+   for (int i = 0; i < nlines; i++) {
+      unsigned int t = capture_line_cycles[i];
+      unsigned int a = capture_line_active_cycles[i];
+      instrument_total[i] += t;
+      instrument_active_total[i] += a;
+      if (t > instrument_worst[i]) {
+         instrument_worst[i] = t;
+      }
+      if (a > instrument_active_worst[i]) {
+         instrument_active_worst[i] = a;
+      }
+   }
+   instrument_fields++;
+   if (!instrument_quiet && instrument_fields >= INSTRUMENT_CAPTURE_INTERVAL) {
+      instrument_capture_report();
+      instrument_capture_reset();
+   }
+}
+#endif
+
+#ifdef BENCHMARK
+extern void capture_line_default_4bpp();
+extern void capture_line_default_8bpp();
+extern void capture_line_inband_4bpp();
+extern void capture_line_inband_8bpp();
+extern void capture_line_default_double_4bpp();
+extern void capture_line_default_double_8bpp();
+extern void capture_line_fast_4bpp();
+extern void capture_line_fast_8bpp();
+extern void capture_line_odd_4bpp();
+extern void capture_line_odd_8bpp();
+extern void capture_line_even_4bpp();
+extern void capture_line_even_8bpp();
+extern void capture_line_half_odd_4bpp();
+extern void capture_line_half_odd_8bpp();
+extern void capture_line_half_even_4bpp();
+extern void capture_line_half_even_8bpp();
+extern void capture_line_mode7_4bpp();
+extern void capture_line_default_sixbits_4bpp();
+extern void capture_line_default_sixbits_8bpp();
+extern void capture_line_ntsc_sixbits_4bpp();
+extern void capture_line_ntsc_sixbits_8bpp();
+extern void capture_line_default_sixbits_double_4bpp();
+extern void capture_line_default_sixbits_double_8bpp();
+extern void capture_line_fast_sixbits_4bpp();
+extern void capture_line_fast_sixbits_8bpp();
+extern void capture_line_default_16bpp();
+extern void capture_line_default_sixbits_16bpp();
+extern void capture_line_deinterlace_4bpp();
+extern void capture_line_deinterlace_8bpp();
+extern void capture_line_deinterlace_sixbits_4bpp();
+extern void capture_line_deinterlace_sixbits_8bpp();
+
+typedef struct {
+   const char *name;
+   func_ptr capture_4bpp;
+   func_ptr capture_8bpp;
+   func_ptr capture_16bpp;
+   int sixbits;
+   int double_width;
+   int direct_only;     // reads back from the comparison buffer, so never staged
+} benchmark_kernel_t;
+
+static const benchmark_kernel_t benchmark_kernels[] = {
+   { "default",         capture_line_default_4bpp,                capture_line_default_8bpp,                capture_line_default_16bpp,         0, 0, 0 },
+   { "inband",          capture_line_inband_4bpp,                 capture_line_inband_8bpp,                 NULL,                               0, 0, 0 },
+   { "double",          capture_line_default_double_4bpp,         capture_line_default_double_8bpp,         NULL,                               0, 1, 0 },
+   { "fast",            capture_line_fast_4bpp,                   capture_line_fast_8bpp,                   NULL,                               0, 0, 0 },
+   { "odd",             capture_line_odd_4bpp,                    capture_line_odd_8bpp,                    NULL,                               0, 0, 0 },
+   { "even",            capture_line_even_4bpp,                   capture_line_even_8bpp,                   NULL,                               0, 0, 0 },
+   { "half_odd",        capture_line_half_odd_4bpp,               capture_line_half_odd_8bpp,               NULL,                               0, 0, 0 },
+   { "half_even",       capture_line_half_even_4bpp,              capture_line_half_even_8bpp,              NULL,                               0, 0, 0 },
+   { "mode7",           capture_line_mode7_4bpp,                  NULL,                                     NULL,                               0, 0, 0 },
+   { "deinterlace",     capture_line_deinterlace_4bpp,            capture_line_deinterlace_8bpp,            NULL,                               0, 0, 1 },
+   { "sixbits",         capture_line_default_sixbits_4bpp,        capture_line_default_sixbits_8bpp,        capture_line_default_sixbits_16bpp, 1, 0, 0 },
+   { "ntsc",            capture_line_ntsc_sixbits_4bpp,           capture_line_ntsc_sixbits_8bpp,           NULL,                               1, 0, 0 },
+   { "sixbits_double",  capture_line_default_sixbits_double_4bpp, capture_line_default_sixbits_double_8bpp, NULL,                               1, 1, 0 },
+   { "sixbits_deint",   capture_line_deinterlace_sixbits_4bpp,    capture_line_deinterlace_sixbits_8bpp,    NULL,                               1, 0, 1 },
+   { "fast_sixbits",    capture_line_fast_sixbits_4bpp,           capture_line_fast_sixbits_8bpp,           NULL,                               1, 0, 0 },
+   { NULL }
+};
+
+// Run each capture line function that is compatible with the current CPLD
+// and frame buffer against the live source, and compare the cycles taken per
+// psync edge with the time between psync edges at the current sampling clock.
+// A function that can't keep up takes longer than the budget per edge.
+//
+// Each function is run both capturing directly into the frame buffer and via
+// the line staging buffer. The result is for the current line_staging setting.
+static void benchmark_capture_kernels() {
+   // Every entry of the table points at the function under test
+   static int table[17];
+   int failures = 0;
+   int saved_chars_per_line = capinfo->chars_per_line;
+   int saved_ncapture = capinfo->ncapture;
+   int (*saved_capture_line)() = capinfo->capture_line;
+   int saved_line_staging = line_staging;
+   unsigned int flags = extra_flags() | mode7 | BIT_CALIBRATE | (2 << OFFSET_NBUFFERS);
+
+   // Time between psync edges in ARM cycles (four 3-bit pixels or two 6-bit pixels per edge)
+   double budget = (double)(capinfo->sample_width ? 2 : 4) * 1e9 / clkinfo.clock * cpuspeed / 1000;
+
+   log_info("Capture benchmark: clock=%dHz, cpu=%dMHz, budget=%.1f cycles/psync edge, margin=%d%%",
+            clkinfo.clock, cpuspeed, budget, BENCHMARK_MARGIN);
+   log_info("                   Direct        Staged");
+   log_info("Function           Mean   Worst  Mean   Worst  Result");
+   instrument_quiet = 1;
+   for (const benchmark_kernel_t *kernel = benchmark_kernels; kernel->name; kernel++) {
+      func_ptr capture = (capinfo->bpp == 16) ? kernel->capture_16bpp : (capinfo->bpp == 8) ? kernel->capture_8bpp : kernel->capture_4bpp;
+      if (!capture || kernel->sixbits != capinfo->sample_width) {
+         continue;
+      }
+      // rgb_to_fb.S always uses the mode 7 function for teletext
+      if ((capinfo->video_type == VIDEO_TELETEXT) != (kernel->capture_4bpp == capture_line_mode7_4bpp)) {
+         continue;
+      }
+      for (int i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+         table[i] = (int)capture;
+      }
+      capinfo->capture_line = (int (*)())table;
+      // Double width functions write two words for every one captured
+      capinfo->chars_per_line = saved_chars_per_line >> kernel->double_width;
+      capinfo->ncapture = BENCHMARK_FIELDS;
+      double mean[2];
+      double worst[2];
+      for (int staged = 0; staged < 2 - kernel->direct_only; staged++) {
+         line_staging = staged;
+         instrument_nlines = -1;
+         rgb_to_fb(capinfo, flags);
+         instrument_capture_summary(&mean[staged], &worst[staged]);
+      }
+      if (kernel->direct_only) {
+         mean[1] = mean[0];
+         worst[1] = worst[0];
+      }
+      int fail = worst[saved_line_staging ? 1 : 0] > budget * (100 + BENCHMARK_MARGIN) / 100;
+      if (fail) {
+         failures++;
+      }
+      log_info("%-16s %6.1f  %6.1f  %6.1f  %6.1f  %s", kernel->name, mean[0], worst[0], mean[1], worst[1], fail ? "FAIL" : "ok");
+   }
+   instrument_quiet = 0;
+   capinfo->chars_per_line = saved_chars_per_line;
+   capinfo->ncapture = saved_ncapture;
+   capinfo->capture_line = saved_capture_line;
+   line_staging = saved_line_staging;
+   if (failures) {
+      log_warn("Capture benchmark: %d function(s) over budget", failures);
+      sprintf(status, "Benchmark: %d capture function(s) over budget", failures);
+   } else {
+      log_info("Capture benchmark: all functions within budget");
+   }
+}
+
+// Time the C reference Mode 7 deinterlacers (mode7_ref.c) on synthetic
+// fields, for comparison with capture_line_mode7_4bpp above. The frame
+// buffer and comparison buffer are in cached memory (dummyscreen) so this
+// is the processing cost alone, without waiting for psync.
+static void benchmark_mode7_reference() {
+   static const char *names[] = { "none", "bob", "ma1", "ma2", "ma3", "ma4", "adv" };
+   static uint32_t capture[2][MODE7_REF_MAX_WORDS + 2];  // the advanced deinterlacer works in groups of three words
+   int nwords = capinfo->chars_per_line;
+   int nlines = capinfo->nlines;
+   if (nwords > MODE7_REF_MAX_WORDS) {
+      nwords = MODE7_REF_MAX_WORDS;
+   }
+   // Two lines per field line (both fields) in the frame buffer and the same again for the comparison buffer
+   int pitch = (nwords + 15) & ~15;
+   if ((4 * nlines + 2) * pitch * sizeof(uint32_t) > 1920 * 1080) {
+      nlines = 1920 * 1080 / sizeof(uint32_t) / pitch / 4 - 1;
+   }
+   uint32_t *fb = (uint32_t *)&dummyscreen + pitch;
+   uint32_t *cmp = fb + 2 * nlines * pitch + pitch;
+
+   // Two fields of teletext-like data (background with a few foreground pixels), differing in every fourth word
+   uint32_t seed = 0x12345678;
+   for (int i = 0; i < nwords; i++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      capture[0][i] = seed & 0x07000700;
+      capture[1][i] = (i & 3) ? capture[0][i] : (seed & 0x00700070);
+   }
+   // Time between two psync edges (one word) in ARM cycles
+   double budget = 2 * 4 * 1e9 / clkinfo.clock * cpuspeed / 1000;
+   log_info("Mode 7 reference benchmark: %d words x %d lines, budget=%.1f cycles/word", nwords, nlines, budget);
+   for (int setting = DEINTERLACE_NONE; setting <= DEINTERLACE_ADV; setting++) {
+      unsigned int total = 0;
+      unsigned int worst = 0;
+      for (int field = 0; field < BENCHMARK_FIELDS; field++) {
+         uint32_t flags = (setting << OFFSET_INTERLACE) | ((field & 1) ? BIT_FIELD_TYPE : 0);
+         for (int line = 0; line < nlines; line++) {
+            unsigned int t = _get_cycle_counter();
+            mode7_ref_line(capture[field & 1], nwords, fb + 2 * line * pitch, cmp + 2 * line * pitch, pitch, flags, line % 10, rounding_lookup);
+            t = _get_cycle_counter() - t;
+            total += t;
+            if (t > worst) {
+               worst = t;
+            }
+         }
+      }
+      log_info("%-16s %6.1f  %6.1f cycles/word", names[setting], (double) total / BENCHMARK_FIELDS / nlines / nwords, (double) worst / nwords);
+   }
+   // Leave the comparison buffer as capture expects to find it
+   memset(&dummyscreen, 0, (4 * nlines + 2) * pitch * sizeof(uint32_t));
+}
+
+// Check capture_line_mode7_4bpp against the C reference deinterlacers on live
+// fields. For each deinterlace setting a field is captured with the assembler
+// and the captured words are read back from where it left them, then the same
+// words are replayed through mode7_ref_line starting from copies of the frame
+// buffer and comparison buffer taken before the field. The two results must
+// match word for word.
+//
+// The motion adaptive settings leave the captured words (plus flag bits) in
+// the comparison buffer. None and bob only write the frame buffer, so for
+// them the words are read back from there and the check covers the other
+// field's lines and the OSD bits.
+//
+// The copies are kept in frame buffers 2 and 3, which Mode 7 doesn't use.
+static void selfcheck_mode7_reference() {
+   static const char *names[] = { "none", "bob", "ma1", "ma2", "ma3", "ma4", "adv", "adv_map" };
+   static uint32_t capture[MODE7_REF_MAX_WORDS + 2];
+   int nwords = capinfo->chars_per_line;
+   if (nwords > MODE7_REF_MAX_WORDS) {
+      log_warn("Mode 7 reference check: %d words per line is too many, skipped", nwords);
+      return;
+   }
+   int saved_ncapture = capinfo->ncapture;
+   int pitch = capinfo->pitch >> 2;
+   int size = capinfo->height * pitch;
+   int step = (capinfo->sizex2 & 1) ? 2 * pitch : pitch;
+   uint32_t *fb = (uint32_t *)capinfo->fb;
+   uint32_t *fb_ref = fb + 2 * size;
+   uint32_t *cmp_ref = fb + 3 * size;
+#ifdef USE_CACHED_COMPARISON_BUFFER
+   uint32_t *cmp = (uint32_t *)&dummyscreen;
+#else
+   uint32_t *cmp = fb + size;
+#endif
+   int failures = 0;
+   unsigned int base_flags = (extra_flags() & ~BIT_OSD) | mode7;
+
+   log_info("Mode 7 reference check: %d words x %d lines", nwords, capinfo->nlines);
+   for (int setting = DEINTERLACE_NONE; setting <= DEINTERLACE_ADV_MAP; setting++) {
+      unsigned int flags = base_flags | (setting << OFFSET_INTERLACE);
+      // Let the buffers settle with this setting, then copy them and capture one more field
+      capinfo->ncapture = 2;
+      rgb_to_fb(capinfo, flags);
+      memcpy(fb_ref, fb, size << 2);
+      memcpy(cmp_ref, cmp, size << 2);
+      capinfo->ncapture = 1;
+      int ret = rgb_to_fb(capinfo, flags);
+      if (!(ret & RET_EXPIRED)) {
+         log_info("%-16s skipped (capture returned %04x)", names[setting], ret);
+         continue;
+      }
+      unsigned int field_flags = flags | field_type;
+      // Mode 7 fields start one line down in the odd field (except on an Electron)
+      int offset = capinfo->v_adjust * pitch + (capinfo->h_adjust >> 2) + ((!elk_mode && !field_type) ? pitch : 0);
+      int ncaptured = (setting >= DEINTERLACE_ADV) ? (nwords + 2) / 3 * 3 : nwords;
+      for (int line = 0; line < capinfo->nlines; line++) {
+         int i = offset + line * step;
+         for (int w = 0; w < ncaptured; w++) {
+            if (setting >= DEINTERLACE_ADV) {
+               capture[w] = cmp[i + w];
+            } else if (setting >= DEINTERLACE_MA1) {
+               capture[w] = cmp[i + w] & 0x77777777;
+            } else {
+               capture[w] = fb[i + w] & 0x77777777;
+            }
+         }
+         mode7_ref_line(capture, nwords, fb_ref + i, cmp_ref + i, pitch, field_flags, (capinfo->v_offset + 1 + line) % 10, rounding_lookup);
+      }
+      int fb_errors = 0;
+      int cmp_errors = 0;
+      int first = -1;
+      for (int i = 0; i < size; i++) {
+         if (fb[i] != fb_ref[i]) {
+            fb_errors++;
+            first = (first < 0) ? i : first;
+         }
+         if (cmp[i] != cmp_ref[i]) {
+            cmp_errors++;
+            first = (first < 0) ? i : first;
+         }
+      }
+      if (fb_errors || cmp_errors) {
+         failures++;
+         log_info("%-16s FAIL %d frame buffer and %d comparison buffer words differ, first at line %d word %d",
+                  names[setting], fb_errors, cmp_errors, first / pitch, first % pitch);
+      } else {
+         log_info("%-16s ok (%s field)", names[setting], field_type ? "even" : "odd");
+      }
+   }
+   capinfo->ncapture = saved_ncapture;
+   if (failures) {
+      log_warn("Mode 7 reference check: %d setting(s) differ from the assembler", failures);
+      sprintf(status, "Benchmark: %d Mode 7 reference(s) differ", failures);
+   } else {
+      log_info("Mode 7 reference check: all settings match the assembler");
+   }
+}
+#endif
+
 int diff_N_frames(capture_info_t *capinfo, int n, int mode7, int elk) {
    int result = 0;
 
@@ -1382,9 +1921,240 @@ int diff_N_frames(capture_info_t *capinfo, int n, int mode7, int elk) {
    for (int i = 0; i < NUM_OFFSETS; i++) {
       result += by_offset[i];
    }
+#ifdef CAL_LOG
+   last_diff_errors = result;
+#endif
    return result;
 }
 
+// The frame difference engine used by diff_N_frames_by_sample
+//
+// Rather than walk every pixel, each word is mapped a byte at a time through a
+// LUT to the equivalence classes of its pixels (so equivalent colours compare
+// equal), the two words are xored and each pixel's field is folded down to its
+// lowest bit. These bits are summed in SWAR counters (each pixel position counts
+// in its own field of the word) for each of the three word phases of the six
+// sample offsets, and the counters are flushed before any field can overflow.
+
+static uint8_t diff_class_lut[256];
+
+static void diff_build_class_lut(int bpp) {
+   for (int i = 0; i < 256; i++) {
+      if (bpp == 8) {
+         diff_class_lut[i] = osd_get_equivalence(i & 0x7f) & 0x7f;
+      } else {
+         diff_class_lut[i] = (osd_get_equivalence(i & 0x07) & 0x07) | ((osd_get_equivalence((i >> 4) & 0x07) & 0x07) << 4);
+      }
+   }
+}
+
+// Returns a word with the lowest bit of each pixel's field set if the pixel differs
+static inline uint32_t diff_word(uint32_t a, uint32_t b, int bpp) {
+   uint32_t x;
+   if (bpp == 16) {
+      // direct colour, equivalent colours are already the same value
+      x = a ^ b;
+      return ((x & 0xffff) ? 1 : 0) | ((x >> 16) ? 0x10000 : 0);
+   }
+   x = (diff_class_lut[a & 0xff] ^ diff_class_lut[b & 0xff])
+      | ((diff_class_lut[(a >> 8) & 0xff] ^ diff_class_lut[(b >> 8) & 0xff]) << 8)
+      | ((diff_class_lut[(a >> 16) & 0xff] ^ diff_class_lut[(b >> 16) & 0xff]) << 16)
+      | ((diff_class_lut[a >> 24] ^ diff_class_lut[b >> 24]) << 24);
+   if (bpp == 8) {
+      x |= x >> 4;
+      x |= x >> 2;
+      x |= x >> 1;
+      return x & 0x01010101;
+   }
+   x |= (x >> 1) | (x >> 2);
+   return x & 0x11111111;
+}
+
+// Adds the counters for each word phase to the sample offsets and clears them
+static void diff_flush(uint32_t *acc, int *diff, int bpp) {
+   uint32_t field_mask = (bpp == 16) ? 0xffff : (1 << bpp) - 1;
+   for (int phase = 0; phase < 3; phase++) {
+      // Pixel k of a word at byte offset x is at sample offset ((x << 1) + k) % 6
+      int index = phase << 1;
+      for (int shift = 0; shift < 32; shift += bpp) {
+         diff[index] += (acc[phase] >> shift) & field_mask;
+         index = (index + 1) % NUM_OFFSETS;
+      }
+      acc[phase] = 0;
+   }
+}
+
+// The pixels of a word mapped to their equivalence classes, so equivalent colours compare the same
+static inline uint32_t diff_class_word(uint32_t a, int bpp) {
+   if (bpp == 16) {
+      return a;
+   }
+   return diff_class_lut[a & 0xff] | (diff_class_lut[(a >> 8) & 0xff] << 8)
+      | (diff_class_lut[(a >> 16) & 0xff] << 16) | (diff_class_lut[a >> 24] << 24);
+}
+
+// Returns 1 if frame buffer line y might contain a flashing cursor
+// (the cursor rows were determined empirically)
+static int is_cursor_line(capture_info_t *capinfo, int y, int elk) {
+   // Calculate the capture scan line number (allowing for a double hight framebuffer)
+   // (capinfo->height is the framebuffer height after any doubling)
+   int line = (capinfo->sizex2 & 1) ? (y >> 1) : y;
+   // As v_offset increases, e.g. by one, the screen image moves up one capture line
+   // (the hardcoded constant of 21 relates to the BBC video format)
+   line += (capinfo->v_offset - 21);
+   if (line < 0) {
+      return 0;
+   }
+   if (elk) {
+      // Eliminate cursor lines in 32 row modes (0,1,2,4,5)
+      if (capinfo->video_type != VIDEO_TELETEXT && (line % 8) == 5) {
+         return 1;
+      }
+      // Eliminate cursor lines in 25 row modes (3, 6)
+      if (capinfo->video_type != VIDEO_TELETEXT && (line % 10) == 3) {
+         return 1;
+      }
+      // Eliminate cursor lines in mode 7
+      // (this case is untested as I don't have a Jafa board)
+      if (capinfo->video_type == VIDEO_TELETEXT && (line % 10) == 7) {
+         return 1;
+      }
+   } else {
+      // Eliminate cursor lines in 32 row modes (0,1,2,4,5)
+      if (capinfo->video_type != VIDEO_TELETEXT && (line % 8) == 7) {
+         return 1;
+      }
+      // Eliminate cursor lines in 25 row modes (3, 6)
+      if (capinfo->video_type != VIDEO_TELETEXT && (line % 10) >= 5 && (line % 10) <= 7) {
+         return 1;
+      }
+      // Eliminate cursor lines in mode 7
+      if (capinfo->video_type == VIDEO_TELETEXT && (line % 10) == 7) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+#ifdef CAL_VOLATILE_MASK
+// One bit per cell for each frame buffer line compared, set if the cell's
+// content changes by itself (and so will be ignored by calibration)
+static uint32_t volatile_mask[CAL_MASK_MAX_LINES];
+static int volatile_mask_lines = 0;    // 0 if there is no usable mask
+static int volatile_mask_pitch = 0;
+static int volatile_mask_cell_words = 0;
+
+// The two states seen in each cell while the mask is built
+#define CELL_CURRENT  0x01             // the cell is in state b
+#define CELL_HAS_B    0x02             // a second state has been seen
+#define CELL_REJECTED 0x04             // a third state, or a state that didn't last
+#define CELL_RUN      0xf0             // frames the cell has been in the current state (saturating)
+#define CELL_RUN_1    0x10
+static uint16_t cell_state_a[CAL_MASK_MAX_LINES * CAL_MASK_CELLS];
+static uint16_t cell_state_b[CAL_MASK_MAX_LINES * CAL_MASK_CELLS];
+static uint8_t  cell_status[CAL_MASK_MAX_LINES * CAL_MASK_CELLS];
+
+// Tracks a cell's state (a hash of its pixels) from one frame to the next
+static void update_cell(int cell, uint16_t state, int first) {
+   uint8_t status = cell_status[cell];
+   if (first) {
+      cell_state_a[cell] = state;
+      cell_status[cell] = CELL_RUN_1;
+      return;
+   }
+   if (status & CELL_REJECTED) {
+      return;
+   }
+   if (state == ((status & CELL_CURRENT) ? cell_state_b[cell] : cell_state_a[cell])) {
+      if ((status & CELL_RUN) != CELL_RUN) {
+         status += CELL_RUN_1;
+      }
+   } else if ((status & CELL_RUN) < CAL_MASK_STABLE_FRAMES * CELL_RUN_1) {
+      // The state it's leaving didn't last, so it's noise rather than content
+      status |= CELL_REJECTED;
+   } else if (!(status & CELL_HAS_B)) {
+      cell_state_b[cell] = state;
+      status = CELL_HAS_B | CELL_CURRENT | CELL_RUN_1;
+   } else if (state == ((status & CELL_CURRENT) ? cell_state_a[cell] : cell_state_b[cell])) {
+      status = ((status ^ CELL_CURRENT) & ~CELL_RUN) | CELL_RUN_1;
+   } else {
+      status |= CELL_REJECTED;
+   }
+   cell_status[cell] = status;
+}
+
+// Finds the cells whose content changes by themselves, such as flashing
+// cursors and clocks.
+//
+// Comparing frames only at the current sample offsets can't tell content
+// changes from sampling errors, and the current offsets are the ones about to
+// be searched (and after a failed cache check, ones known to be wrong), which
+// would hide the errors calibration is looking for. Instead a cell is only
+// masked if its pixels switch between exactly two states, each lasting at
+// least CAL_MASK_STABLE_FRAMES, which content does at any sample offset but
+// errors at a marginal offset (a different, short lived state each frame)
+// don't.
+void build_volatile_mask(capture_info_t *capinfo, int mode7, int elk) {
+   unsigned int ret;
+   unsigned int flags = extra_flags() | mode7 | BIT_CALIBRATE | (2 << OFFSET_NBUFFERS);
+   int bpp = capinfo->bpp;
+   geometry_get_fb_params(capinfo);
+   capinfo->ncapture = (capinfo->video_type == VIDEO_TELETEXT) ? 2 : 1;
+   int nlines = capinfo->nlines << (capinfo->sizex2 & 1);
+   int words = capinfo->pitch >> 2;
+   int cell_words = (words + CAL_MASK_CELLS - 1) / CAL_MASK_CELLS;
+   int cells = (words + cell_words - 1) / cell_words;
+   int changed = 0;
+
+   volatile_mask_lines = 0;
+   if (nlines > CAL_MASK_MAX_LINES) {
+      log_info("Volatile mask: too many lines (%d)", nlines);
+      return;
+   }
+   diff_build_class_lut(bpp);
+
+   for (int i = 0; i < CAL_MASK_FRAMES; i++) {
+#ifdef MULTI_BUFFER
+      ret = rgb_to_fb(capinfo, flags | ((i == 0 && capinfo->video_type == VIDEO_TELETEXT) ? BIT_CLEAR : 0));
+#else
+      ret = rgb_to_fb(capinfo, flags);
+#endif
+      uint32_t *fbp = (uint32_t *)(capinfo->fb + ((ret >> OFFSET_LAST_BUFFER) & 3) * capinfo->height * capinfo->pitch + capinfo->v_adjust * capinfo->pitch);
+      for (int y = 0; y < nlines; y++) {
+         for (int w = 0, cell = y * CAL_MASK_CELLS; w < words; cell++) {
+            int end = (w + cell_words < words) ? w + cell_words : words;
+            uint32_t hash = 0x9E3779B9;
+            for (; w < end; w++) {
+               hash = (hash ^ diff_class_word(*fbp++, bpp)) * 0x85EBCA6B;
+               hash ^= hash >> 15;
+            }
+            update_cell(cell, hash ^ (hash >> 16), i == 0);
+         }
+      }
+   }
+
+   for (int y = 0; y < nlines; y++) {
+      volatile_mask[y] = 0;
+      for (int c = 0; c < cells; c++) {
+         uint8_t status = cell_status[y * CAL_MASK_CELLS + c];
+         if ((status & (CELL_HAS_B | CELL_REJECTED)) == CELL_HAS_B && (status & CELL_RUN) >= CAL_MASK_STABLE_FRAMES * CELL_RUN_1) {
+            volatile_mask[y] |= 1 << c;
+            changed++;
+         }
+      }
+   }
+   int total = nlines * cells;
+   if (changed * 100 > total * CAL_MASK_MAX_PERCENT) {
+      log_info("Volatile mask: %d of %d cells changed, assuming sampling noise", changed, total);
+      return;
+   }
+   log_info("Volatile mask: %d of %d cells ignored", changed, total);
+   volatile_mask_lines = nlines;
+   volatile_mask_pitch = capinfo->pitch;
+   volatile_mask_cell_words = cell_words;
+}
+#endif
+
 int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk) {
 
    unsigned int ret;
@@ -1410,20 +2180,35 @@ int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk)
 
    unsigned int flags = extra_flags() | mode7 | BIT_CALIBRATE | (2 << OFFSET_NBUFFERS);
 
-   uint32_t bpp      = capinfo->bpp;
-   uint32_t pix_mask = (bpp == 8) ? 0x0000007F : 0x00000007;
-   uint32_t osd_mask = (bpp == 8) ? 0x7F7F7F7F : 0x77777777;
+   int bpp = capinfo->bpp;
+   // Counters for each word phase, flushed before a pixel's field can overflow
+   uint32_t acc[3];
+   int flush_count = (bpp == 16) ? 0xffff : (1 << bpp) - 1;
+   diff_build_class_lut(bpp);
 
    geometry_get_fb_params(capinfo);            // required as calibration sets delay to 0 and the 2 high bits of that adjust the h offset
    // In mode 0..6, capture one field
    // In mode 7,    capture two fields
    capinfo->ncapture = (capinfo->video_type == VIDEO_TELETEXT) ? 2 : 1;
 
+   // Use the volatile mask rather than the cursor rows if it was made for this frame buffer
+   int use_mask = 0;
+#ifdef CAL_VOLATILE_MASK
+   use_mask = volatile_mask_lines == (capinfo->nlines << (capinfo->sizex2 & 1)) && volatile_mask_pitch == capinfo->pitch;
+#endif
+
 #ifdef INSTRUMENT_CAL
    t = _get_cycle_counter();
 #endif
    // Grab an initial frame
+#ifdef MULTI_BUFFER
+   // Each frame is written to a different buffer, so start from a clear screen
+   // to make the areas that aren't captured match (in modes 0..6 the buffers
+   // are already in use, in Mode 7 only buffer 0 is normally written)
+   ret = rgb_to_fb(capinfo, flags | ((capinfo->video_type == VIDEO_TELETEXT) ? BIT_CLEAR : 0));
+#else
    ret = rgb_to_fb(capinfo, flags);
+#endif
 #ifdef INSTRUMENT_CAL
    t_capture += _get_cycle_counter() - t;
 #endif
@@ -1433,15 +2218,26 @@ int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk)
       for (int j = 0; j < NUM_OFFSETS; j++) {
          diff[j] = 0;
       }
+      acc[0] = acc[1] = acc[2] = 0;
+      int count = 0;
 
+#ifdef MULTI_BUFFER
+      // The next frame is written to another buffer, so the last frame is compared in place
+      uint32_t *lastp = (uint32_t *)(capinfo->fb + ((ret >> OFFSET_LAST_BUFFER) & 3) * capinfo->height * capinfo->pitch + capinfo->v_adjust * capinfo->pitch);
+#ifdef INSTRUMENT_CAL
+      t = _get_cycle_counter();
+#endif
+#else
 #ifdef INSTRUMENT_CAL
       t = _get_cycle_counter();
 #endif
       // Save the last frame
       memcpy((void *)last, (void *)(capinfo->fb + ((ret >> OFFSET_LAST_BUFFER) & 3) * capinfo->height * capinfo->pitch), capinfo->height * capinfo->pitch);
+      uint32_t *lastp = (uint32_t *)last + capinfo->v_adjust * (capinfo->pitch >> 2);
 #ifdef INSTRUMENT_CAL
       t_memcpy += _get_cycle_counter() - t;
       t = _get_cycle_counter();
+#endif
 #endif
       // Grab the next frame
       ret = rgb_to_fb(capinfo, flags);
@@ -1451,46 +2247,38 @@ int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk)
 #endif
       // Compare the frames
       uint32_t *fbp = (uint32_t *)(capinfo->fb + ((ret >> OFFSET_LAST_BUFFER) & 3) * capinfo->height * capinfo->pitch + capinfo->v_adjust * capinfo->pitch);
-      uint32_t *lastp = (uint32_t *)last + capinfo->v_adjust * (capinfo->pitch >> 2);
       for (int y = 0; y < (capinfo->nlines << (capinfo->sizex2 & 1)); y++) {
          int skip = 0;
-         // Calculate the capture scan line number (allowing for a double hight framebuffer)
-         // (capinfo->height is the framebuffer height after any doubling)
-         int line = (capinfo->sizex2 & 1) ? (y >> 1) : y;
-         // As v_offset increases, e.g. by one, the screen image moves up one capture line
-         // (the hardcoded constant of 21 relates to the BBC video format)
-         line += (capinfo->v_offset - 21);
-         // Skip lines that might contain flashing cursor
-         // (the cursor rows were determined empirically)
-         if (line >= 0) {
-            if (elk) {
-               // Eliminate cursor lines in 32 row modes (0,1,2,4,5)
-               if (capinfo->video_type != VIDEO_TELETEXT && (line % 8) == 5) {
-                  skip = 1;
+#ifdef CAL_VOLATILE_MASK
+         uint32_t cells = use_mask ? volatile_mask[y] : 0;
+         if (cells) {
+            // Only compare the cells that didn't change by themselves
+            int words = capinfo->pitch >> 2;
+            for (int w = 0, cell = 0; w < words; cell++) {
+               int end = w + volatile_mask_cell_words;
+               if (end > words) {
+                  end = words;
                }
-               // Eliminate cursor lines in 25 row modes (3, 6)
-               if (capinfo->video_type != VIDEO_TELETEXT && (line % 10) == 3) {
-                  skip = 1;
-               }
-               // Eliminate cursor lines in mode 7
-               // (this case is untested as I don't have a Jafa board)
-               if (capinfo->video_type == VIDEO_TELETEXT && (line % 10) == 7) {
-                  skip = 1;
-               }
-            } else {
-               // Eliminate cursor lines in 32 row modes (0,1,2,4,5)
-               if (capinfo->video_type != VIDEO_TELETEXT && (line % 8) == 7) {
-                  skip = 1;
+               if (cells & (1 << cell)) {
+                  fbp   += end - w;
+                  lastp += end - w;
+                  w = end;
+                  continue;
                }
-               // Eliminate cursor lines in 25 row modes (3, 6)
-               if (capinfo->video_type != VIDEO_TELETEXT && (line % 10) >= 5 && (line % 10) <= 7) {
-                  skip = 1;
-               }
-               // Eliminate cursor lines in mode 7
-               if (capinfo->video_type == VIDEO_TELETEXT && (line % 10) == 7) {
-                  skip = 1;
+               for (; w < end; w++) {
+                  acc[w % 3] += diff_word(*fbp++, *lastp++, bpp);
+                  if (++count == flush_count) {
+                     diff_flush(acc, diff, bpp);
+                     count = 0;
+                  }
                }
             }
+            continue;
+         }
+#endif
+         // Skip lines that might contain flashing cursor, unless the volatile mask covers them
+         if (!use_mask) {
+            skip = is_cursor_line(capinfo, y, elk);
          }
          if (skip) {
             // For debugging it's useful to see if the lines being eliminated align with the cursor
@@ -1500,20 +2288,18 @@ int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk)
             fbp   += capinfo->pitch >> 2;
             lastp += capinfo->pitch >> 2;
          } else {
+            int phase = 0;
             for (int x = 0; x < capinfo->pitch; x += 4) {
-               uint32_t d = osd_get_equivalence(*fbp++ & osd_mask) ^ osd_get_equivalence(*lastp++ & osd_mask);
-               // Work out the starting index
-               int index = (x << 1) % 6;
-               while (d) {
-                  if (d & pix_mask) {
-                     diff[index]++;
-                  }
-                  d >>= bpp;
-                  index = (index + 1) % NUM_OFFSETS;
+               acc[phase] += diff_word(*fbp++, *lastp++, bpp);
+               phase = (phase == 2) ? 0 : phase + 1;
+               if (++count == flush_count) {
+                  diff_flush(acc, diff, bpp);
+                  count = 0;
                }
             }
          }
       }
+      diff_flush(acc, diff, bpp);
 #ifdef INSTRUMENT_CAL
       t_compare += _get_cycle_counter() - t;
 #endif
@@ -1563,6 +2349,390 @@ int *diff_N_frames_by_sample(capture_info_t *capinfo, int n, int mode7, int elk)
    return sum;
 }
 
+#ifdef CAL_COARSE_TO_FINE
+// How well each sample point value is known during the search
+#define CAL_UNKNOWN 0
+#define CAL_COARSE  1
+#define CAL_REFINED 2
+
+// Returns the lowest centre of a window of three values with no errors that
+// have been measured to at least the given level, or -1 if there isn't one or
+// a lower window might still turn out to have no errors
+static int zero_window(int *metrics, int *known, int range, int level) {
+   for (int i = 0; i < range; i++) {
+      int window[3] = { (i - 1 + range) % range, i, (i + 1) % range };
+      int found = 1;
+      for (int j = 0; j < 3; j++) {
+         int value = window[j];
+         if (known[value] == CAL_UNKNOWN || (known[value] < level && metrics[value] == 0)) {
+            return -1;
+         }
+         if (metrics[value] != 0) {
+            found = 0;
+         }
+      }
+      if (found) {
+         return i;
+      }
+   }
+   return -1;
+}
+#endif
+
+// Measures the errors over n frames at each sample point value 0..range-1 into
+// metrics[] and returns the smallest, for cpld_calibrate to pick a value from.
+//
+// measure() selects the sample point value and returns the errors over the
+// requested number of frames.
+//
+// With CAL_COARSE_TO_FINE, the values are first swept over NUM_CAL_COARSE_FRAMES
+// frames (scaled up to n frames), stopping once a window of three values with no
+// errors is found. A value is then measured over n frames if its estimate is no
+// worse than the best measured value, as are the neighbours of the best measured
+// values (for the three sample window). It stops as soon as the lowest window
+// with no errors is confirmed, as nothing can beat that. The values that weren't
+// measured over n frames are set to -1 in metrics[], and cpld_calibrate leaves
+// any window containing one out of its search. Every value with the smallest
+// metric has both neighbours measured, unless the search stopped at the lowest
+// window with no errors, so it picks the same value as when every value is
+// measured over n frames.
+int calibrate_sample_points(capture_info_t *capinfo, int range, int n, int *metrics, int elk, int (*measure)(capture_info_t *capinfo, int value, int n, int elk)) {
+   int min_metric = INT_MAX;
+#ifdef CAL_LOG
+   unsigned int start_time = cal_log_now();
+#endif
+#ifdef CAL_COARSE_TO_FINE
+   int known[range];
+   int seed = 0;
+   int frames = 0;
+   int changed;
+
+   for (int value = 0; value < range; value++) {
+      known[value] = CAL_UNKNOWN;
+   }
+
+   // The sweep starts with the last value so the window around value 0 is seen first
+   log_info("Coarse sweep over %d frames", NUM_CAL_COARSE_FRAMES);
+   for (int k = 0; k < range; k++) {
+      int value = (k + range - 1) % range;
+      metrics[value] = measure(capinfo, value, NUM_CAL_COARSE_FRAMES, elk) * n / NUM_CAL_COARSE_FRAMES;
+      known[value] = CAL_COARSE;
+      frames += NUM_CAL_COARSE_FRAMES;
+      if (metrics[value] < metrics[seed] || known[seed] == CAL_UNKNOWN) {
+         seed = value;
+      }
+      if (zero_window(metrics, known, range, CAL_COARSE) >= 0) {
+         seed = zero_window(metrics, known, range, CAL_COARSE);
+         break;
+      }
+   }
+
+   // Refine, starting from the best value in the sweep
+   log_info("Refining over %d frames", n);
+   do {
+      changed = 0;
+      for (int k = 0; k < range; k++) {
+         int i     = (seed + k) % range;
+         int left  = (i - 1 + range) % range;
+         int right = (i + 1) % range;
+         int candidate;
+         if (known[i] == CAL_REFINED) {
+            candidate = metrics[i] == min_metric && (known[left] != CAL_REFINED || known[right] != CAL_REFINED);
+         } else {
+            candidate = known[i] == CAL_UNKNOWN || metrics[i] <= min_metric;
+         }
+         if (candidate) {
+            int window[3] = { left, i, right };
+            for (int j = 0; j < 3; j++) {
+               int value = window[j];
+               if (known[value] != CAL_REFINED) {
+                  metrics[value] = measure(capinfo, value, n, elk);
+                  known[value] = CAL_REFINED;
+                  frames += n;
+                  if (metrics[value] < min_metric) {
+                     min_metric = metrics[value];
+                  }
+               }
+            }
+            changed = 1;
+            if (zero_window(metrics, known, range, CAL_REFINED) >= 0) {
+               log_info("Zero error window found at %d", zero_window(metrics, known, range, CAL_REFINED));
+               changed = 0;
+               break;
+            }
+         }
+      }
+   } while (changed);
+
+   // Anything that wasn't refined is marked as not measured, rather than given
+   // a made up value, so the window search leaves it out
+   for (int value = 0; value < range; value++) {
+      if (known[value] != CAL_REFINED) {
+         metrics[value] = -1;
+      }
+   }
+   log_info("Search measured %d frames (exhaustive = %d)", frames, range * n);
+#else
+   int frames = range * n;
+   for (int value = 0; value < range; value++) {
+      metrics[value] = measure(capinfo, value, n, elk);
+      if (metrics[value] < min_metric) {
+         min_metric = metrics[value];
+      }
+   }
+#endif
+#ifdef CAL_LOG
+   cal_log_add(CAL_PHASE_SAMPLE, start_time);
+   cal_log_metrics(range, metrics, frames);
+#endif
+   return min_metric;
+}
+
+#ifdef CAL_DAC_LEVELS
+// The DAC value at the lower end of histogram bin i
+static int dac_sweep_value(int i) {
+   return i * 255 / CAL_DAC_STEPS;
+}
+
+// Adds the number of pixels in a captured frame with each pixel bit set to counts
+static void count_pixel_bits(capture_info_t *capinfo, int mode7, int *counts) {
+   unsigned int flags = extra_flags() | mode7 | BIT_CALIBRATE | (2 << OFFSET_NBUFFERS);
+   int bpp = capinfo->bpp;
+   uint32_t lsbs = (bpp == 4) ? 0x11111111 : 0x01010101;
+   capinfo->ncapture = (capinfo->video_type == VIDEO_TELETEXT) ? 2 : 1;
+   int ret = rgb_to_fb(capinfo, flags);
+   uint32_t *fbp = (uint32_t *)(capinfo->fb + ((ret >> OFFSET_LAST_BUFFER) & 3) * capinfo->height * capinfo->pitch + capinfo->v_adjust * capinfo->pitch);
+   int nlines = capinfo->nlines << (capinfo->sizex2 & 1);
+   int words = capinfo->pitch >> 2;
+   for (int y = 0; y < nlines; y++) {
+      for (int w = 0; w < words; w++) {
+         uint32_t word = *fbp++;
+         for (int b = 0; b < bpp; b++) {
+            counts[b] += __builtin_popcount(word & (lsbs << b));
+         }
+      }
+   }
+}
+
+// Counts the pixel bits at DAC value i of the sweep, unless they have been already
+static void measure_dac_value(capture_info_t *capinfo, int mode7, int num, int i, int counts[][8], int *measured) {
+   if (measured[i]) {
+      return;
+   }
+   for (int b = 0; b < 8; b++) {
+      counts[i][b] = 0;
+   }
+   cpld->set_value(num, dac_sweep_value(i));
+   for (int f = 0; f < CAL_DAC_FRAMES; f++) {
+      count_pixel_bits(capinfo, mode7, counts[i]);
+   }
+   measured[i] = 1;
+}
+
+// The number of pixel bits that changed between DAC values i and j of the sweep
+static int dac_bin_changes(int counts[][8], int i, int j, int *use_bit, int bpp) {
+   int changes = 0;
+   for (int b = 0; b < bpp; b++) {
+      if (use_bit[b]) {
+         changes += abs(counts[j][b] - counts[i][b]);
+      }
+   }
+   return changes;
+}
+
+// Finds the lowest (or if upper, the highest) wide gap in a histogram of n
+// bins: the runs of bins no more than empty between the first and last bins
+// above it. Gaps less than half the width of the widest are taken to be noise
+// within a level. Returns 0 if there is no gap.
+static int find_dac_gap(int *histogram, int n, int empty, int upper, int *gap_start, int *gap_end) {
+   int first = -1;
+   int last = -1;
+   for (int i = 0; i < n; i++) {
+      if (histogram[i] > empty) {
+         if (first < 0) {
+            first = i;
+         }
+         last = i;
+      }
+   }
+
+   // Pass 0 finds the widest gap, pass 1 picks the lowest or highest wide gap
+   int widest = 0;
+   *gap_start = -1;
+   *gap_end = -1;
+   for (int pass = 0; pass < 2; pass++) {
+      int start = -1;
+      for (int i = first; i <= last && first >= 0; i++) {
+         if (histogram[i] <= empty) {
+            if (start < 0) {
+               start = i;
+            }
+         } else if (start >= 0) {
+            int width = i - start;
+            if (pass == 0) {
+               if (width > widest) {
+                  widest = width;
+               }
+            } else if (width * 2 >= widest && (upper || *gap_start < 0)) {
+               *gap_start = start;
+               *gap_end = i;
+            }
+            start = -1;
+         }
+      }
+      if (widest == 0) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+// Sweeps the threshold DAC param num and sets it to the middle of the lowest
+// (or if upper, the highest) gap between the levels the source produces.
+//
+// The number of pixels that change between adjacent DAC values is a
+// histogram of the source levels seen by the comparator, so the gaps are
+// the runs of empty bins between the levels.
+//
+// The sweep is first made in CAL_DAC_COARSE_STEPS, then only the coarse bins
+// either side of the gap that was found are swept at the full resolution to
+// find its edges. If the coarse sweep finds no gap (the levels are closer
+// than a coarse bin) the rest of the DAC values are swept as well.
+//
+// Returns the new value, or -1 if the DAC was left unchanged
+int calibrate_dac_level(capture_info_t *capinfo, int mode7, int num, int upper, dac_level_t *level) {
+   static int counts[CAL_DAC_STEPS + 1][8];
+   int measured[CAL_DAC_STEPS + 1];
+   int coarse[CAL_DAC_COARSE_STEPS];
+   int use_bit[8];
+   int max_range = 0;
+   int peak = 0;
+   int bpp = capinfo->bpp;
+   int stride = CAL_DAC_STEPS / CAL_DAC_COARSE_STEPS;
+   int gap_start;
+   int gap_end;
+   const char *label = cpld->get_params()[num].label;
+
+   level->old_value = cpld->get_value(num);
+   level->value = -1;
+   for (int i = 0; i < CAL_DAC_STEPS; i++) {
+      level->histogram[i] = 0;
+   }
+   for (int i = 0; i <= CAL_DAC_STEPS; i++) {
+      measured[i] = 0;
+   }
+   if (bpp > 8) {
+      log_info("%s: not calibrated at %d bpp", label, bpp);
+      return -1;
+   }
+
+#ifdef CAL_LOG
+   unsigned int start_time = cal_log_now();
+#endif
+   geometry_get_fb_params(capinfo);
+   for (int i = 0; i <= CAL_DAC_STEPS; i += stride) {
+      measure_dac_value(capinfo, mode7, num, i, counts, measured);
+   }
+
+   // The bits the DAC switches are the ones whose counts change the most
+   for (int b = 0; b < bpp; b++) {
+      int min = INT_MAX;
+      int max = 0;
+      for (int i = 0; i <= CAL_DAC_STEPS; i += stride) {
+         if (counts[i][b] < min) {
+            min = counts[i][b];
+         }
+         if (counts[i][b] > max) {
+            max = counts[i][b];
+         }
+      }
+      use_bit[b] = max - min;
+      if (use_bit[b] > max_range) {
+         max_range = use_bit[b];
+      }
+   }
+   if (max_range < CAL_DAC_MIN_PIXELS) {
+      cpld->set_value(num, level->old_value);
+#ifdef CAL_LOG
+      cal_log_add(CAL_PHASE_DAC, start_time);
+#endif
+      log_info("%s: not used in this mode", label);
+      return -1;
+   }
+   for (int b = 0; b < bpp; b++) {
+      use_bit[b] = use_bit[b] * 2 >= max_range;
+   }
+
+   for (int k = 0; k < CAL_DAC_COARSE_STEPS; k++) {
+      coarse[k] = dac_bin_changes(counts, k * stride, (k + 1) * stride, use_bit, bpp);
+      if (coarse[k] > peak) {
+         peak = coarse[k];
+      }
+   }
+   if (find_dac_gap(coarse, CAL_DAC_COARSE_STEPS, peak / CAL_DAC_GAP_RATIO, upper, &gap_start, &gap_end)) {
+      // Refine the coarse bins that hold the edges of the gap
+      for (int i = (gap_start - 1) * stride + 1; i < gap_start * stride; i++) {
+         measure_dac_value(capinfo, mode7, num, i, counts, measured);
+      }
+      for (int i = gap_end * stride + 1; i < (gap_end + 1) * stride; i++) {
+         measure_dac_value(capinfo, mode7, num, i, counts, measured);
+      }
+   } else {
+      for (int i = 0; i <= CAL_DAC_STEPS; i++) {
+         measure_dac_value(capinfo, mode7, num, i, counts, measured);
+      }
+   }
+   cpld->set_value(num, level->old_value);
+#ifdef CAL_LOG
+   cal_log_add(CAL_PHASE_DAC, start_time);
+#endif
+
+   // Full resolution bins where both ends were measured, the rest share out their coarse bin
+   peak = 0;
+   for (int i = 0; i < CAL_DAC_STEPS; i++) {
+      if (measured[i] && measured[i + 1]) {
+         level->histogram[i] = dac_bin_changes(counts, i, i + 1, use_bit, bpp);
+      } else {
+         level->histogram[i] = coarse[i / stride] / stride;
+      }
+      if (level->histogram[i] > peak) {
+         peak = level->histogram[i];
+      }
+   }
+   if (!find_dac_gap(level->histogram, CAL_DAC_STEPS, peak / CAL_DAC_GAP_RATIO, upper, &gap_start, &gap_end)) {
+      log_info("%s: no gap between levels", label);
+      return -1;
+   }
+
+   level->value = (dac_sweep_value(gap_start) + dac_sweep_value(gap_end)) / 2;
+   cpld->set_value(num, level->value);
+   log_info("%s: gap %d..%d, %d -> %d", label, dac_sweep_value(gap_start), dac_sweep_value(gap_end), level->old_value, level->value);
+   return level->value;
+}
+
+// The histogram as one character per bin, with the chosen value marked
+const char *dac_level_histogram(dac_level_t *level) {
+   static const char scale[] = " .:-=+*#";
+   static char buffer[CAL_DAC_STEPS + 1];
+   int peak = 1;
+   for (int i = 0; i < CAL_DAC_STEPS; i++) {
+      if (level->histogram[i] > peak) {
+         peak = level->histogram[i];
+      }
+   }
+   for (int i = 0; i < CAL_DAC_STEPS; i++) {
+      int h = level->histogram[i];
+      buffer[i] = h ? scale[1 + h * (sizeof(scale) - 3) / peak] : ' ';
+   }
+   if (level->value >= 0) {
+      int bin = level->value * CAL_DAC_STEPS / 255;
+      buffer[bin < CAL_DAC_STEPS ? bin : CAL_DAC_STEPS - 1] = '|';
+   }
+   buffer[CAL_DAC_STEPS] = 0;
+   return buffer;
+}
+#endif
+
 #define MODE7_CHAR_WIDTH 12
 
 signed int analyze_mode7_alignment(capture_info_t *capinfo) {
@@ -1698,6 +2868,19 @@ signed int analyze_default_alignment(capture_info_t *capinfo) {
       fbp += capinfo->pitch >> 2;
     }
 
+   } else if (capinfo->bpp == 16) {
+    for (int line = 0; line <  capinfo->nlines << (capinfo->sizex2 & 1); line++) {
+      int index = 0;
+      uint16_t *pixel_ptr = (uint16_t *) fbp;
+      for (int x = 0; x < (capinfo->chars_per_line << 3); x++) {
+         if (*pixel_ptr++) {
+            counts[index]++;
+         }
+         index = (index + 1) % DEFAULT_CHAR_WIDTH;
+      }
+      fbp += capinfo->pitch >> 2;
+    }
+
    } else {
     for (int line = 0; line <  capinfo->nlines << (capinfo->sizex2 & 1); line++) {
       int index = 0;
@@ -1830,6 +3013,168 @@ void swapBuffer(int buffer) {
 }
 #endif
 
+#ifdef TIME_DISPLAY_VSYNC
+// The display field period in ARM cycles, or 0 if it isn't known (recalculate_hdmi_clock returns early on the Pi 4)
+static unsigned int display_vsync_period() {
+   if (display_vsync_freq <= 0) {
+      return 0;
+   }
+   return (unsigned int) ((double) cpuspeed * 1000000 / display_vsync_freq);
+}
+#endif
+
+#ifdef FRAME_RATE_CONVERSION
+static frc_t frc;
+static double frc_display_vsync_freq = 0;
+static unsigned int last_display_vsync_time = 0;
+static int rateconvert = 0;
+
+// Frame rate conversion is used, when it's turned on, whenever the display isn't genlocked to the source
+static int frc_active() {
+   return rateconvert && capinfo->video_type != VIDEO_TELETEXT && (vlockmode == HDMI_ORIGINAL || vlock_limited) && display_vsync_freq > 0;
+}
+
+static void frc_reset() {
+   frc_init(&frc, display_vsync_period(), FRC_GUARD_US * cpuspeed);
+   frc_display_vsync_freq = display_vsync_freq;
+   last_display_vsync_time = display_vsync_time;
+}
+
+// Returns how long after now the frame should be flipped to
+static unsigned int frc_present(unsigned int now) {
+   if (display_vsync_freq != frc_display_vsync_freq) {
+      frc_reset();
+   }
+   if (display_vsync_time != last_display_vsync_time) {
+      last_display_vsync_time = display_vsync_time;
+      frc_vsync(&frc, display_vsync_time);
+   }
+   unsigned int wait = frc_schedule(&frc, now);
+   if (frc.presented % FRC_LOG_FRAMES == 0 && frc.presented != 0) {
+      log_info("Frame rate conversion: %u frames, %u repeated, %u dropped", frc.presented, frc.repeated, frc.dropped);
+   }
+   return wait;
+}
+
+// Called from SHOW_VSYNC, once per source line, when the time of a flip held back by present_buffer has come
+void present_pending_buffer() {
+   int buffer = pending_flip_buffer;
+   pending_flip_buffer = -1;
+   swapBuffer(buffer);
+}
+#endif
+
+#ifdef INSTRUMENT_LATENCY
+static unsigned int latency_frames = 0;
+static double latency_min;
+static double latency_max;
+static double latency_sum;
+// The last summary (min, mean and max in ms), if latency_report_frames != 0
+static unsigned int latency_report_frames = 0;
+static double latency_report[3];
+
+static void latency_reset() {
+   latency_frames = 0;
+   latency_report_frames = 0;
+}
+
+// Converts a latency in ms to source lines
+static int latency_lines(double ms) {
+   return one_line_time_ns ? (int) (ms * 1000000 / one_line_time_ns + 0.5) : 0;
+}
+
+// Works out the latency of the first and last captured lines of the frame
+// being flipped to at now. Each is scanned out from the first display vsync
+// after the flip, plus the display lines down to the framebuffer row it was
+// drawn to (taking the vsync interrupt to be at the start of the vertical
+// sync). Only the lines of the latest field are timed, so when deinterlacing
+// the lines kept from the previous field are older than this.
+static void instrument_latency(unsigned int now) {
+   unsigned int period = display_vsync_period();
+   unsigned int elapsed = now - display_vsync_time;
+   int nlines = capinfo->nlines;
+   if (period == 0 || nlines < 2 || elapsed / period >= DISPLAY_VSYNC_MAX_PREDICT) {
+      return;
+   }
+   // Times are relative to now, so the cycle counter wrapping doesn't matter
+   double shown = (double) ((elapsed / period + 1) * period - elapsed);
+   uint32_t vtotal = (*PIXELVALVE2_VERTA) + (*PIXELVALVE2_VERTB);
+   vtotal = (vtotal + (vtotal >> 16)) & 0xFFFF;
+   int vertical_sync = (*PIXELVALVE2_VERTA) & 0xFFFF;
+   int back_porch = (*PIXELVALVE2_VERTA) >> 16;
+   if (vtotal == 0) {
+      return;
+   }
+   double display_line = (double) period / vtotal;
+   int double_height = capinfo->sizex2 & 1;
+   double scale = (double) (get_vdisplay() - v_overscan) / capinfo->height;
+   double active = vertical_sync + back_porch + (v_overscan >> 1);
+   double first_scanned = shown + (active + capinfo->v_adjust * scale) * display_line;
+   double last_scanned = shown + (active + (capinfo->v_adjust + ((nlines - 1) << double_height)) * scale) * display_line;
+
+   // The lines are captured evenly from the start of the active lines to the end of the last one
+   double started = (double) (now - latency_start_time);
+   double last_captured = (double) (now - last_hsync_time);
+   double first_captured = started - (started - last_captured) / nlines;
+
+   double first = first_scanned + first_captured;
+   double last = last_scanned + last_captured;
+   double lo = (first < last) ? first : last;
+   double hi = (first < last) ? last : first;
+   if (latency_frames == 0) {
+      latency_min = lo;
+      latency_max = hi;
+      latency_sum = 0;
+   }
+   if (lo < latency_min) {
+      latency_min = lo;
+   }
+   if (hi > latency_max) {
+      latency_max = hi;
+   }
+   latency_sum += (first + last) / 2;
+   if (++latency_frames >= INSTRUMENT_LATENCY_INTERVAL) {
+      double cycles_per_ms = (double) cpuspeed * 1000;
+      latency_report[0] = latency_min / cycles_per_ms;
+      latency_report[1] = latency_sum / latency_frames / cycles_per_ms;
+      latency_report[2] = latency_max / cycles_per_ms;
+      latency_report_frames = latency_frames;
+      latency_frames = 0;
+      log_info("Latency: min %.2lf ms (%d lines), mean %.2lf ms (%d lines), max %.2lf ms (%d lines)",
+               latency_report[0], latency_lines(latency_report[0]), latency_report[1], latency_lines(latency_report[1]),
+               latency_report[2], latency_lines(latency_report[2]));
+      log_info("Latency: nbuffers = %d, vlockmode = %d, genlocked = %d, deinterlace = %d", nbuffers, vlockmode, genlock.locked, deinterlace);
+   }
+}
+#endif
+
+#ifdef TIME_DISPLAY_VSYNC
+// Called from FLIP_BUFFER in place of swapBuffer
+void present_buffer(int buffer) {
+   unsigned int now = _get_cycle_counter();
+   unsigned int wait = 0;
+#ifdef FRAME_RATE_CONVERSION
+   if (frc_active()) {
+      wait = frc_present(now);
+   }
+   // A newer frame replaces one still waiting to be flipped to
+   pending_flip_buffer = -1;
+#endif
+#ifdef INSTRUMENT_LATENCY
+   instrument_latency(now + wait);
+#endif
+#ifdef FRAME_RATE_CONVERSION
+   if (wait) {
+      // Don't hold up the capture, SHOW_VSYNC flips to it on the first line after the wait
+      pending_flip_time = now + wait;
+      pending_flip_buffer = buffer;
+      return;
+   }
+#endif
+   swapBuffer(buffer);
+}
+#endif
+
 int get_current_display_buffer() {
    if (capinfo->video_type == VIDEO_TELETEXT) {
        return 0;
@@ -2067,6 +3412,19 @@ void set_nbuffers(int val) {
 }
 #endif
 
+#ifdef FRAME_RATE_CONVERSION
+void set_rateconvert(int on) {
+   if (on && !rateconvert) {
+      frc_reset();
+   }
+   rateconvert = on;
+}
+
+int get_rateconvert() {
+   return rateconvert;
+}
+#endif
+
 void set_debug(int on) {
    debug = on;
 }
@@ -2119,18 +3477,291 @@ void action_calibrate_clocks() {
    set_vlockmode(HDMI_EXACT);
 }
 
+// Builds the volatile mask and runs the CPLD calibration
+static void run_cpld_calibration() {
+#ifdef CAL_VOLATILE_MASK
+#ifdef CAL_LOG
+   unsigned int start_time = cal_log_now();
+#endif
+   build_volatile_mask(capinfo, mode7, elk_mode);
+#ifdef CAL_LOG
+   cal_log_add(CAL_PHASE_MASK, start_time);
+#endif
+#endif
+   for (int c = 0; c < NUM_CAL_PASSES; c++) {
+      cpld->calibrate(capinfo, elk_mode);
+   }
+}
+
+#if defined(CAL_CACHE) || defined(CAL_LOG)
+static void get_cal_cache_key(cal_cache_key_t *key) {
+   strncpy(key->profile, get_profile_name(profile), sizeof(key->profile) - 1);
+   key->profile[sizeof(key->profile) - 1] = 0;
+   strncpy(key->sub_profile, get_sub_profile_name(profile, subprofile), sizeof(key->sub_profile) - 1);
+   key->sub_profile[sizeof(key->sub_profile) - 1] = 0;
+   key->mode7 = mode7;
+   key->line_time_ns = one_line_time_ns;
+   key->lines_per_frame = lines_per_frame;
+   key->clock = clkinfo.clock;
+}
+#endif
+
+#ifdef CAL_CACHE
+// Applies the cached calibration for the current timing if the capture is
+// stable with it. Otherwise the profile's values are kept: calibration only
+// runs (and is only cached) when the user starts it.
+static void apply_cached_calibration() {
+   cal_cache_key_t key;
+   get_cal_cache_key(&key);
+   if (!cal_cache_apply(&key)) {
+      return;
+   }
+#ifdef CAL_LOG
+   cal_log_begin();
+   cal_log_set(CAL_PHASE_CLOCK, clock_time_us);
+   unsigned int start_time = cal_log_now();
+#endif
+   int errors = diff_N_frames(capinfo, NUM_CAL_COARSE_FRAMES, mode7, elk_mode);
+#ifdef CAL_LOG
+   cal_log_add(CAL_PHASE_VERIFY, start_time);
+#endif
+   if (errors != 0) {
+      log_info("Calibration cache: errors = %d, keeping the profile's values", errors);
+      cal_cache_undo();
+   }
+#ifdef CAL_LOG
+   cal_log_end(errors ? CAL_LOG_STALE : CAL_LOG_CACHED, &key, clock_error_ppm, errors);
+#endif
+}
+#endif
+
+#ifdef USE_CAL_MONITOR
+cal_monitor_t cal_monitor = { .metric = -1, .direction = 1 };
+
+// Longest frame buffer line compared (in words)
+#define CAL_MONITOR_MAX_WORDS 1024
+
+// A copy of the band of lines being compared, taken one frame earlier
+static uint32_t cal_monitor_band[CAL_MONITOR_BAND_LINES * CAL_MONITOR_MAX_WORDS];
+static int cal_monitor_y = 0;          // first frame buffer line of the band
+static int cal_monitor_saved = 0;      // fields since the band was copied (0 = not copied)
+static int cal_monitor_errors = 0;     // totals for the frame so far
+static int cal_monitor_left = 0;
+static int cal_monitor_right = 0;
+static int cal_monitor_lean = 0;       // which way the errors leaned in the last frames
+static int cal_monitor_moved = 0;      // the last move, until the next frame confirms it
+static int cal_monitor_before = 0;     // the errors before that move (x16)
+
+static void cal_monitor_reset() {
+   cal_monitor.metric = -1;
+   cal_monitor.consistent = 0;
+   cal_monitor_y = 0;
+   cal_monitor_saved = 0;
+   cal_monitor_errors = 0;
+   cal_monitor_left = 0;
+   cal_monitor_right = 0;
+   cal_monitor_lean = 0;
+   cal_monitor_moved = 0;
+}
+
+// Moves all the sample offsets by step, unless that would take any out of range
+static int cal_monitor_shift(int step) {
+   param_t *params = cpld->get_params();
+   for (int i = 0; params[i].key >= 0; i++) {
+      if (is_offset_param(&params[i])) {
+         int value = cpld->get_value(params[i].key) + step;
+         if (value < params[i].min || value > params[i].max) {
+            return 0;
+         }
+      }
+   }
+   for (int i = 0; params[i].key >= 0; i++) {
+      if (is_offset_param(&params[i])) {
+         cpld->set_value(params[i].key, cpld->get_value(params[i].key) + step);
+      }
+   }
+   return 1;
+}
+
+// Counts the pixels that differ between two words, and of those the ones where
+// one of the two values is the pixel's left neighbour (but not its right one)
+// or its right neighbour (but not its left one). A pixel sampled too close to
+// one of its edges flickers with the neighbour on that side.
+static void cal_monitor_compare(uint32_t a, uint32_t b, int bpp) {
+   if (a == b) {
+      return;
+   }
+   uint32_t ca = diff_class_word(a, bpp);
+   uint32_t cb = diff_class_word(b, bpp);
+   if (ca == cb) {
+      return;
+   }
+   if (bpp == 16) {
+      cal_monitor_errors += ((ca ^ cb) & 0xffff ? 1 : 0) + ((ca ^ cb) >> 16 ? 1 : 0);
+      return;
+   }
+   uint32_t mask = (1 << bpp) - 1;
+   int n = 32 / bpp;
+   // Pixel 0 (the leftmost) is in the lowest bits
+   for (int k = 0; k < n; k++) {
+      uint32_t pa = (ca >> (k * bpp)) & mask;
+      uint32_t pb = (cb >> (k * bpp)) & mask;
+      if (pa == pb) {
+         continue;
+      }
+      cal_monitor_errors++;
+      if (k == 0 || k == n - 1) {
+         continue;
+      }
+      uint32_t left = (cb >> ((k - 1) * bpp)) & mask;
+      uint32_t right = (cb >> ((k + 1) * bpp)) & mask;
+      int is_left = (pa == left || pb == left);
+      int is_right = (pa == right || pb == right);
+      if (is_left && !is_right) {
+         cal_monitor_left++;
+      } else if (is_right && !is_left) {
+         cal_monitor_right++;
+      }
+   }
+}
+
+// Called once the bands have covered a whole frame
+static void cal_monitor_frame() {
+   int errors = cal_monitor_errors << 4;
+   cal_monitor.measurements++;
+   if (cal_monitor_moved != 0) {
+      // Keep the last move only if the errors went down, otherwise the
+      // offsets sample the other way to what was assumed
+      if (errors >= cal_monitor_before) {
+         cal_monitor_shift(-cal_monitor_moved);
+         cal_monitor.direction = -cal_monitor.direction;
+         log_info("Calibration monitor: move %+d undone, errors %d -> %d", cal_monitor_moved, cal_monitor_before >> 4, errors >> 4);
+         cal_monitor.metric = cal_monitor_before;
+         cal_monitor_moved = 0;
+         return;
+      }
+      cal_monitor.drift_events++;
+      cal_monitor.last_drift = cal_monitor_moved;
+      cal_monitor_moved = 0;
+   }
+   cal_monitor.metric = (cal_monitor.metric < 0) ? errors : cal_monitor.metric + ((errors - cal_monitor.metric) >> 2);
+   // Errors clearly on one edge of the pixels mean the sampling point has
+   // drifted towards that edge
+   int lean = 0;
+   if (cal_monitor_left > cal_monitor_right * CAL_MONITOR_HYSTERESIS) {
+      lean = -1;
+   } else if (cal_monitor_right > cal_monitor_left * CAL_MONITOR_HYSTERESIS) {
+      lean = 1;
+   }
+   if (lean != 0 && lean == cal_monitor_lean) {
+      cal_monitor.consistent++;
+   } else {
+      cal_monitor.consistent = (lean != 0);
+   }
+   cal_monitor_lean = lean;
+   cal_monitor.last_lean = lean;
+   if (cal_monitor.consistent >= CAL_MONITOR_CONSISTENT) {
+      // Sample later when too early (errors on the left edge), and earlier when too late
+      int step = (lean < 0) ? cal_monitor.direction : -cal_monitor.direction;
+      if (cal_monitor_shift(step)) {
+         log_info("Calibration monitor: sample offsets moved %+d, %d errors (%d left, %d right)", step, cal_monitor_errors, cal_monitor_left, cal_monitor_right);
+         cal_monitor_moved = step;
+         cal_monitor_before = errors;
+      }
+      cal_monitor.consistent = 0;
+      cal_monitor_lean = 0;
+   }
+}
+
+// Called from rgb_to_fb once per captured field, after the buffer flip
+//
+// The live frames are compared a band of CAL_MONITOR_BAND_LINES lines at a
+// time: the band is copied from the buffer just drawn, and compared with the
+// same band two fields later (one frame of either field type). Nothing is
+// captured or displayed for the monitor, and the sample offsets only change
+// when the errors lean consistently to one edge of the pixels.
+void cal_monitor_field(int flags) {
+   if ((flags & (BIT_OSD | BIT_CALIBRATE | BIT_PROBE)) || !sync_detected) {
+      cal_monitor_saved = 0;
+      return;
+   }
+   int bpp = capinfo->bpp;
+   int nlines = capinfo->nlines << (capinfo->sizex2 & 1);
+   int words = capinfo->pitch >> 2;
+   if (words > CAL_MONITOR_MAX_WORDS) {
+      words = CAL_MONITOR_MAX_WORDS;
+   }
+   if (cal_monitor_y >= nlines) {
+      cal_monitor_y = 0;
+   }
+   int lines = nlines - cal_monitor_y;
+   if (lines > CAL_MONITOR_BAND_LINES) {
+      lines = CAL_MONITOR_BAND_LINES;
+   }
+   uint32_t *fbp = (uint32_t *)(capinfo->fb + ((flags >> OFFSET_LAST_BUFFER) & 3) * capinfo->height * capinfo->pitch + (capinfo->v_adjust + cal_monitor_y) * capinfo->pitch);
+   if (cal_monitor_saved == 0) {
+      if (cal_monitor_y == 0) {
+         // The palette may have changed since the last frame
+         diff_build_class_lut(bpp);
+      }
+      for (int y = 0; y < lines; y++) {
+         memcpy(cal_monitor_band + y * words, fbp + y * (capinfo->pitch >> 2), words << 2);
+      }
+      cal_monitor_saved = 1;
+      return;
+   }
+   if (++cal_monitor_saved < 2) {
+      return;
+   }
+   for (int y = 0; y < lines; y++) {
+      if (is_cursor_line(capinfo, cal_monitor_y + y, elk_mode)) {
+         continue;
+      }
+      uint32_t *a = fbp + y * (capinfo->pitch >> 2);
+      uint32_t *b = cal_monitor_band + y * words;
+      for (int x = 0; x < words; x++) {
+         cal_monitor_compare(a[x], b[x], bpp);
+      }
+   }
+   cal_monitor_saved = 0;
+   cal_monitor_y += lines;
+   if (cal_monitor_y >= nlines) {
+      cal_monitor_frame();
+      cal_monitor_y = 0;
+      cal_monitor_errors = 0;
+      cal_monitor_left = 0;
+      cal_monitor_right = 0;
+   }
+}
+#endif
+
 void action_calibrate_auto() {
    // re-measure vsync and set the core/sampling clocks
    calibrate_sampling_clock(0);
+#ifdef CAL_LOG
+   cal_log_begin();
+   cal_log_set(CAL_PHASE_CLOCK, clock_time_us);
+#endif
    // During calibration we do our best to auto-delect an Electron
    log_debug("Elk mode = %d", elk_mode);
-   for (int c = 0; c < NUM_CAL_PASSES; c++) {
-      cpld->calibrate(capinfo, elk_mode);
-   }
+   run_cpld_calibration();
+#if defined(CAL_CACHE) || defined(CAL_LOG)
+   cal_cache_key_t key;
+   get_cal_cache_key(&key);
+#endif
+#ifdef CAL_CACHE
+   cal_cache_store(&key);
+#endif
+#ifdef CAL_LOG
+   cal_log_end(CAL_LOG_MANUAL, &key, clock_error_ppm, last_diff_errors);
+#endif
+#ifdef USE_CAL_MONITOR
+   cal_monitor_reset();
+#endif
 }
 
 int is_genlocked() {
-   return genlocked;
+   return genlock.locked;
 }
 
 void calculate_fb_adjustment() {
@@ -2146,7 +3777,7 @@ void calculate_fb_adjustment() {
        capinfo->h_adjust = 0;
    }
 
-   capinfo->h_adjust = (capinfo->h_adjust >> 1) << (capinfo->bpp == 8 ? 3 : 2);
+   capinfo->h_adjust = (capinfo->h_adjust >> 1) << (capinfo->bpp == 16 ? 4 : capinfo->bpp == 8 ? 3 : 2);
    //log_info("adjust=%d, %d", capinfo->h_adjust, capinfo->v_adjust);
 }
 
@@ -2205,6 +3836,16 @@ void setup_profile(int profile_changed) {
     log_info("Window: H = %d to %d, V = %d to %d, S = %s", hsync_comparison_lo * 1000 / cpuspeed, hsync_comparison_hi * 1000 / cpuspeed, (int)((double)vsync_comparison_lo * 1000 / cpuspeed), (int)((double)vsync_comparison_hi * 1000 / cpuspeed), sync_names[capinfo->sync_type]);
 
     hsync_threshold = (autoswitch == AUTOSWITCH_MODE7) ? BBC_HSYNC_THRESHOLD : OTHER_HSYNC_THRESHOLD;
+
+#ifdef USE_JITTER_COMPENSATION
+    // Restart the line timing model used to compensate hsync jitter
+    jitter_edge_cycles = 0;
+    jitter_period = (int)((double) one_line_time_ns * cpuspeed / 1000 * 16);
+    jitter_resyncs = 0;
+    memset(jitter_histogram, 0, JITTER_BINS * sizeof(unsigned int));
+    jitter_edge_cycles = (int)((double)(capinfo->sample_width ? 2 : 4) * 1e9 / clkinfo.clock * cpuspeed / 1000);
+    log_info("Jitter compensation: %d cycles per psync edge", jitter_edge_cycles);
+#endif
 }
 
 void set_status_message(char *msg) {
@@ -2241,6 +3882,7 @@ void rgb_to_hdmi_main() {
    capinfo->sync_type = SYNC_BIT_COMPOSITE_SYNC;
    cpld->set_mode(0);
    current_display_buffer = 0;
+   genlock_init(&genlock, GENLOCK_CONTROLLER);
    // Determine initial sync polarity (and correct whether inversion required or not)
    capinfo->detected_sync_type = cpld->analyse(capinfo->sync_type, 1);
    log_info("Detected polarity state at startup = %s (%s)", sync_names[capinfo->detected_sync_type & SYNC_BIT_MASK], mixed_names[(capinfo->detected_sync_type & SYNC_BIT_MIXED_SYNC) ? 1 : 0]);
@@ -2286,6 +3928,22 @@ void rgb_to_hdmi_main() {
    while (1) {
       log_info("-----------------------LOOP------------------------");
 
+#ifdef GENLOCK_CACHE
+      // Saves what genlock learned about the previous mode
+      genlock_cache_sync();
+#endif
+#ifdef FRAME_RATE_CONVERSION
+      frc_reset();
+#endif
+#ifdef INSTRUMENT_LATENCY
+      latency_reset();
+#endif
+
+#ifdef CAL_CACHE
+      // Evaluated before last_profile and last_subprofile are updated
+      int cal_required = (result & RET_SYNC_TIMING_CHANGED) || profile != last_profile || last_subprofile != subprofile || mode7 != last_mode7;
+#endif
+
       setup_profile(profile != last_profile || last_subprofile != subprofile);
 
       if ((autoswitch == AUTOSWITCH_PC) && sub_profiles_available(profile) && ((result & RET_SYNC_TIMING_CHANGED) || profile != last_profile || last_subprofile != subprofile)) {
@@ -2308,6 +3966,14 @@ void rgb_to_hdmi_main() {
       log_debug("Done setting up frame buffer");
       //log_info("Peripheral base = %08X", PERIPHERAL_BASE);
       log_info("RAM benchmark: Main memory = %d ns, Screen memory = %d ns", (int) ((double) benchmarkRAM(dummyscreen) * 1000 / cpuspeed), (int) ((double) benchmarkRAM((int) capinfo->fb) * 1000 / cpuspeed));
+      log_info("Line staging: %s", line_staging ? "on" : "off");
+#ifdef BENCHMARK
+      benchmark_capture_kernels();
+      if (capinfo->video_type == VIDEO_TELETEXT) {
+         benchmark_mode7_reference();
+         selfcheck_mode7_reference();
+      }
+#endif
 
       osd_refresh();
 
@@ -2362,6 +4028,15 @@ void rgb_to_hdmi_main() {
      //    log_info(" Regs:%08x %08x = %02x",PERIPHERAL_BASE, i,  *i);
      // }
 
+#ifdef CAL_CACHE
+      if (cal_required && sync_detected) {
+         apply_cached_calibration();
+      }
+#endif
+#ifdef USE_CAL_MONITOR
+      cal_monitor_reset();
+#endif
+
       if (capinfo->border !=0) {
          clear = BIT_CLEAR;
       }
@@ -2370,7 +4045,8 @@ void rgb_to_hdmi_main() {
          geometry_get_fb_params(capinfo);
          capinfo->ncapture = ncapture;
          calculate_fb_adjustment();
-         capinfo->palette_control = paletteControl;
+         // There's no palette control at 16bpp, the capture function is direct colour
+         capinfo->palette_control = (capinfo->bpp == 16) ? PALETTECONTROL_OFF : paletteControl;
          // Update capture info, in case sample width has changed
          // (this also re-selects the appropriate line capture)
          cpld->update_capture_info(capinfo);
@@ -2394,8 +4070,14 @@ void rgb_to_hdmi_main() {
 
          flags |= deinterlace << OFFSET_INTERLACE;
 #ifdef MULTI_BUFFER
+         // The OSD is redrawn after each field, so it must go into a buffer that isn't on screen
          if (capinfo->video_type != VIDEO_TELETEXT && osd_active() && (nbuffers == 0)) {
             flags |= 2 << OFFSET_NBUFFERS;
+#ifdef FRAME_RATE_CONVERSION
+         } else if (frc_active() && nbuffers < 2) {
+            // Triple buffer, so neither the frame on screen nor the one waiting to be shown is drawn over
+            flags |= 2 << OFFSET_NBUFFERS;
+#endif
          } else {
             flags |= nbuffers << OFFSET_NBUFFERS;
          }
@@ -2450,6 +4132,12 @@ void rgb_to_hdmi_main() {
 
          log_debug("Entering rgb_to_fb, flags=%08x", flags);
          result = rgb_to_fb(capinfo, flags);
+#ifdef FRAME_RATE_CONVERSION
+         // Nothing polls for a held back flip outside of rgb_to_fb, so make it now
+         if (pending_flip_buffer >= 0) {
+            present_pending_buffer();
+         }
+#endif
          log_debug("Leaving rgb_to_fb, result=%04x", result);
 
          if (result & RET_SYNC_TIMING_CHANGED) {
@@ -2500,8 +4188,8 @@ void rgb_to_hdmi_main() {
          }
 
          if (clk_changed || (result & RET_INTERLACE_CHANGED) || lock_fail != 0) {
-            target_difference = 0;
-            resync_count = 0;
+            genlock.target = 0;
+            genlock.resync_count = 0;
             // Measure the frame time and set the sampling clock
             calibrate_sampling_clock(0);
             // Force recalculation of the HDMI clock (if the vlockmode property requires this)
@@ -2527,6 +4215,10 @@ int show_detected_status(int line) {
     osd_set(line++, 0, message);    
     sprintf(message, "    Clock error: %d PPM", clock_error_ppm);
     osd_set(line++, 0, message);
+#ifdef USE_CLOCK_TRACKER
+    sprintf(message, "  Tracked error: %.2f PPM (%d trims)", tracked_ppm, tracker_trims);
+    osd_set(line++, 0, message);
+#endif
     sprintf(message, "  Line duration: %d ns", one_line_time_ns);
     osd_set(line++, 0, message);
     if (lines_per_vsync == lines_per_frame) {
@@ -2547,7 +4239,7 @@ int show_detected_status(int line) {
     osd_set(line++, 0, message);
     sprintf(message, "    H & V range: %d-%d x %d-%d", capinfo->h_offset, capinfo->h_offset + (capinfo->chars_per_line << (3 - double_width)) - 1, capinfo->v_offset, capinfo->v_offset + capinfo->nlines - 1);
     osd_set(line++, 0, message);
-    sprintf(message, "   Frame Buffer: %d x %d (%d x %d)", capinfo->width, capinfo->height, capinfo->pitch << (capinfo->bpp == 4 ? 1 : 0), capinfo->height);
+    sprintf(message, "   Frame Buffer: %d x %d (%d x %d)", capinfo->width, capinfo->height, capinfo->bpp == 16 ? capinfo->pitch >> 1 : capinfo->pitch << (capinfo->bpp == 4 ? 1 : 0), capinfo->height);
     osd_set(line++, 0, message);
     int h_size = get_hdisplay();
     int v_size = get_vdisplay();
@@ -2555,6 +4247,20 @@ int show_detected_status(int line) {
     osd_set(line++, 0, message);
     sprintf(message, "  Pi Frame rate: %d Hz (%.2f Hz)", display_vsync_freq_hz, display_vsync_freq);
     osd_set(line++, 0, message);
+#ifdef FRAME_RATE_CONVERSION
+    if (frc_active()) {
+        sprintf(message, "   Rate convert: %u rep, %u drop", frc.repeated, frc.dropped);
+        osd_set(line++, 0, message);
+    }
+#endif
+#ifdef INSTRUMENT_LATENCY
+    if (latency_report_frames != 0) {
+        sprintf(message, "        Latency: %.1f/%.1f/%.1f ms", latency_report[0], latency_report[1], latency_report[2]);
+        osd_set(line++, 0, message);
+        sprintf(message, "  Latency lines: %d/%d/%d", latency_lines(latency_report[0]), latency_lines(latency_report[1]), latency_lines(latency_report[2]));
+        osd_set(line++, 0, message);
+    }
+#endif
     sprintf(message, "    Pi Overscan: %d x %d", h_overscan, v_overscan);
     osd_set(line++, 0, message);
     sprintf(message, "        Scaling: %.2f x %.2f", ((double)(h_size - h_overscan)) / capinfo->width, ((double)(v_size - v_overscan)) / capinfo->height);
@@ -42,6 +42,10 @@ int  get_vlockadj();
 void set_nbuffers(int val);
 int  get_nbuffers();
 #endif
+#ifdef FRAME_RATE_CONVERSION
+void set_rateconvert(int on);
+int  get_rateconvert();
+#endif
 void set_autoswitch(int on);
 int  get_autoswitch();
 void set_debug(int on);
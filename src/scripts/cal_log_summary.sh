@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# Summarises one or more calibration logs (Captures/cal_log from the SD card)
+#
+# Usage: cal_log_summary.sh cal_log [cal_log...]
+#
+# Prints one line per source timing (cpld, profile, sub profile, mode7 and
+# line count) with the number of runs of each kind, how often calibration
+# left errors, the spread of the clock error, and the average time taken by
+# each phase. Logs from several machines can be given together.
+
+if [ $# -eq 0 ]; then
+  echo "usage: $0 cal_log [cal_log...]"
+  exit 1
+fi
+
+# Strip the CR that the firmware writes at the end of each line
+cat "$@" | tr -d '\r' | awk -F, '
+/^uptime_ms,/ {
+  # The column numbers come from the header, so older logs still work
+  for (i = 1; i <= NF; i++) {
+    col[$i] = i
+  }
+  nphases = 0
+  for (i = 1; i <= NF; i++) {
+    if ($i ~ /^t_.*_ms$/) {
+      phase[++nphases] = $i
+    }
+  }
+  next
+}
+NF > 1 {
+  key = $col["cpld"] " " $col["profile"] "/" $col["sub_profile"] " mode7=" $col["mode7"] " lines=" $col["lines"]
+  if (!(key in runs)) {
+    keys[++nkeys] = key
+    min_ppm[key] = max_ppm[key] = $col["clock_ppm"]
+  }
+  runs[key]++
+  reason[key, $col["reason"]]++
+  if ($col["errors"] > 0) {
+    failed[key]++
+  }
+  if ($col["reason"] == "manual" || $col["reason"] == "new") {
+    calibrated[key]++
+    frames[key] += $col["frames"]
+  }
+  if ($col["clock_ppm"] < min_ppm[key]) min_ppm[key] = $col["clock_ppm"]
+  if ($col["clock_ppm"] > max_ppm[key]) max_ppm[key] = $col["clock_ppm"]
+  for (p = 1; p <= nphases; p++) {
+    time[key, p] += $col[phase[p]]
+  }
+  # The chosen values, to see if they wander between runs
+  if (values[key] != "" && values[key] != $col["values"]) {
+    changed[key]++
+  }
+  values[key] = $col["values"]
+}
+END {
+  for (k = 1; k <= nkeys; k++) {
+    key = keys[k]
+    n = runs[key]
+    printf "%s\n", key
+    printf "  runs %d: manual %d, new %d, cached %d, stale %d\n", n, reason[key, "manual"], reason[key, "new"], reason[key, "cached"], reason[key, "stale"]
+    printf "  runs with errors %d (%.0f%%), values changed %d times\n", failed[key], 100 * failed[key] / n, changed[key]
+    printf "  clock error %d..%d PPM\n", min_ppm[key], max_ppm[key]
+    if (calibrated[key] > 0) {
+      printf "  search frames %.1f per calibration\n", frames[key] / calibrated[key]
+    }
+    printf "  mean ms:"
+    for (p = 1; p <= nphases; p++) {
+      name = phase[p]
+      sub(/^t_/, "", name)
+      sub(/_ms$/, "", name)
+      printf " %s %.0f", name, time[key, p] / n
+    }
+    printf "\n  last values: %s\n\n", values[key]
+  }
+}'
@@ -0,0 +1,1027 @@
+// Capture line replay harness
+//
+// Runs the capture line functions of a firmware build under unicorn, with
+// each GPLEV0 read replayed from a psync/csync/pixel trace (generated by
+// siggen.c, or a recorded one), capturing into an in-memory frame buffer.
+//
+// For each function it reports the cycles per line and the cycles spent
+// between psync edges against the psync budget, and checks the captured
+// colour bars where the pixel layout is simple. capture_line_mode7_4bpp is
+// also checked against the C reference deinterlacers in mode7_ref.c, for
+// every deinterlace setting, over several fields of a flashing teletext-like
+// pattern. Finally it checks which function choose_capture_line in
+// rgb_to_fb.S picks for some awkward combinations of parameters.
+//
+// Cycles are modelled as one per instruction plus a fixed cost per GPLEV0
+// read (-r), so they follow changes to the code rather than giving absolute
+// Pi timings. A read that finds no new psync edge skips ahead to the next
+// edge, which keeps the busy waits from dominating the replay time.
+//
+// Build and run on the host (from src/scripts, needs unicorn 2):
+//    gcc -O2 -Wall -Wextra -I.. -o capture_replay capture_replay.c ../siggen.c ../mode7_ref.c -lunicorn
+//    ./capture_replay -p 2 ../build/rgb-to-hdmi
+//
+// The argument is the ELF file of a normal build (not the kernel image).
+// A BENCHMARK build runs it as the capture_budget target when the host has
+// unicorn (see CMakeLists.txt).
+//
+// Only core 0 is emulated, so the USE_MULTICORE capture path (core 1
+// sampling into the ring that READ_SAMPLE_RING reads) is not covered at all:
+// builds with USE_MULTICORE are reported and skipped with a zero exit status.
+//
+// Options:
+//    -p pi       Pi model the firmware was built for (1..4, default 2)
+//    -c mhz      CPU clock (default 1000)
+//    -r cycles   cost of a GPLEV0 read (default 40)
+//    -m percent  margin over the psync budget before a function fails (default 10)
+//    -k name     only run this capture line function
+//    -s preset   siggen preset for the non Mode 7 functions (default BBC_Micro or VGA_Graphics)
+//    -t file     replay a recorded trace (raw 32 bit GPLEV0 values, one per psync edge)
+//    -w file     write the trace for the preset and exit
+//    -f fields   fields to replay per function (default 2)
+//    -v          report each line
+//
+// It exits with a non-zero status if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf.h>
+#include <unicorn/unicorn.h>
+#include "defs.h"
+#include "osd.h"
+#include "siggen.h"
+#include "mode7_ref.h"
+
+// Memory map of the emulated Pi, clear of the firmware (which is linked at 0x01F00000)
+#define FB_BASE        0x18000000
+#define FB_PITCH       4096
+#define FB_LINES       1280
+#define FB_SIZE        (FB_PITCH * FB_LINES)   // the comparison buffer follows the frame buffer
+#define STACK_BASE     0x17E00000
+#define STACK_SIZE     0x00100000
+#define RETURN_ADDRESS 0x17D00000              // the emulation stops when a function returns here
+
+#define GPIO_OFFSET    0x200000
+#define GPLEV0_OFFSET  0x34
+
+// Psync edges kept per line
+#define MAX_EDGES      4096
+
+// A capture line function that hasn't returned after this many instructions is stuck
+#define MAX_INSTRUCTIONS 100000000
+
+static int failures = 0;
+
+static int verbose = 0;
+
+// =============================================================
+// Firmware image
+// =============================================================
+
+typedef struct {
+   uint8_t *file;
+   size_t file_size;
+   uint8_t *image;       // the loaded segments
+   uint32_t base;
+   uint32_t size;
+   const Elf32_Sym *syms;
+   int nsyms;
+   const char *strtab;
+} firmware_t;
+
+static int load_firmware(firmware_t *fw, const char *path) {
+   memset(fw, 0, sizeof(firmware_t));
+   FILE *f = fopen(path, "rb");
+   if (!f) {
+      perror(path);
+      return -1;
+   }
+   fseek(f, 0, SEEK_END);
+   fw->file_size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   fw->file = malloc(fw->file_size);
+   if (fread(fw->file, 1, fw->file_size, f) != fw->file_size) {
+      fclose(f);
+      fprintf(stderr, "%s: read failed\n", path);
+      return -1;
+   }
+   fclose(f);
+
+   Elf32_Ehdr *eh = (Elf32_Ehdr *) fw->file;
+   if (fw->file_size < sizeof(Elf32_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+       eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB || eh->e_machine != EM_ARM) {
+      fprintf(stderr, "%s: not a 32 bit little endian ARM ELF file\n", path);
+      return -1;
+   }
+
+   // Map all the loadable segments as one block
+   Elf32_Phdr *ph = (Elf32_Phdr *) (fw->file + eh->e_phoff);
+   uint32_t lo = 0xffffffff;
+   uint32_t hi = 0;
+   for (int i = 0; i < eh->e_phnum; i++) {
+      if (ph[i].p_type == PT_LOAD && ph[i].p_memsz) {
+         if (ph[i].p_vaddr < lo) {
+            lo = ph[i].p_vaddr;
+         }
+         if (ph[i].p_vaddr + ph[i].p_memsz > hi) {
+            hi = ph[i].p_vaddr + ph[i].p_memsz;
+         }
+      }
+   }
+   if (lo >= hi) {
+      fprintf(stderr, "%s: no loadable segments\n", path);
+      return -1;
+   }
+   fw->base = lo & ~0xfff;
+   fw->size = ((hi + 0xfff) & ~0xfff) - fw->base;
+   if (fw->base + fw->size > RETURN_ADDRESS) {
+      fprintf(stderr, "%s: firmware overlaps the harness memory at 0x%08x\n", path, RETURN_ADDRESS);
+      return -1;
+   }
+   fw->image = calloc(fw->size, 1);
+   for (int i = 0; i < eh->e_phnum; i++) {
+      if (ph[i].p_type == PT_LOAD && ph[i].p_filesz) {
+         memcpy(fw->image + ph[i].p_vaddr - fw->base, fw->file + ph[i].p_offset, ph[i].p_filesz);
+      }
+   }
+
+   // The symbols are needed to find the capture line functions
+   Elf32_Shdr *sh = (Elf32_Shdr *) (fw->file + eh->e_shoff);
+   for (int i = 0; i < eh->e_shnum; i++) {
+      if (sh[i].sh_type == SHT_SYMTAB) {
+         fw->syms = (const Elf32_Sym *) (fw->file + sh[i].sh_offset);
+         fw->nsyms = sh[i].sh_size / sizeof(Elf32_Sym);
+         fw->strtab = (const char *) (fw->file + sh[sh[i].sh_link].sh_offset);
+      }
+   }
+   if (!fw->syms) {
+      fprintf(stderr, "%s: no symbols (was it stripped?)\n", path);
+      return -1;
+   }
+   return 0;
+}
+
+static uint32_t find_symbol(firmware_t *fw, const char *name) {
+   for (int i = 0; i < fw->nsyms; i++) {
+      if (fw->syms[i].st_shndx != SHN_UNDEF && !strcmp(fw->strtab + fw->syms[i].st_name, name)) {
+         return fw->syms[i].st_value;
+      }
+   }
+   return 0;
+}
+
+// =============================================================
+// Traces
+// =============================================================
+
+typedef struct {
+   uint32_t *value;      // GPLEV0 at each psync edge
+   uint64_t *time;       // time of each psync edge in CPU cycles
+   int n;
+   int samples_per_field;
+   int samples_per_line;
+   double period;        // CPU cycles between psync edges
+} trace_t;
+
+// Context for the teletext-like pixel source
+typedef struct {
+   int frame;
+} pattern_t;
+
+// 40 characters of 12 pixels by 10 lines per field, with random glyphs,
+// some flashing cells and a block that moves each frame, so every deinterlace
+// setting sees static text, flashing text and motion
+static int pixel_teletext(void *context, int x, int y, int field) {
+   pattern_t *pattern = (pattern_t *) context;
+   int frame = pattern ? pattern->frame : 0;
+   int cx = x / 12;
+   int px = x % 12;
+   int cy = y / 10;
+   int row = (y % 10) * 2 + (field & 1);
+   int fg = 1 + (cx + cy) % 7;
+   int bg = ((cx / 8 + cy / 4) % 3 == 0) ? 4 : 0;
+   if (fg == bg) {
+      fg = 7;
+   }
+   // A block moving right by one character per frame
+   if (cy == 6 && cx == (frame % 40)) {
+      return 3;
+   }
+   // Flashing cells are only visible every other pair of frames
+   if ((cx * 3 + cy) % 7 == 0 && (frame / 2) % 2) {
+      return bg;
+   }
+   if (px < 2 || px > 10 || row >= 18) {
+      return bg;
+   }
+   uint32_t h = (uint32_t) (cx + 1) * 73856093u ^ (uint32_t) (cy + 1) * 19349663u ^ (uint32_t) (row / 2 + 1) * 83492791u;
+   h ^= h >> 13;
+   h *= 0x5bd1e995;
+   h ^= h >> 15;
+   return ((h >> px) & 1) ? fg : bg;
+}
+
+static void trace_free(trace_t *t) {
+   free(t->value);
+   free(t->time);
+   memset(t, 0, sizeof(trace_t));
+}
+
+static void trace_init(trace_t *t, siggen_t *gen, int fields, double cpu_mhz) {
+   const siggen_timing_t *timing = &gen->timing;
+   int pps = (timing->bpp == 6) ? 2 : 4;
+   t->samples_per_field = siggen_samples_per_field(gen);
+   t->samples_per_line = timing->line_len / pps;
+   t->period = (double) pps * 1e9 / timing->clock * cpu_mhz / 1000;
+   t->n = fields * t->samples_per_field;
+   t->value = malloc(t->n * sizeof(uint32_t));
+   t->time = malloc(t->n * sizeof(uint64_t));
+}
+
+static void trace_generate(trace_t *t, const siggen_timing_t *timing, siggen_pixel_fn pixel, int fields, double cpu_mhz) {
+   siggen_t gen;
+   siggen_sample_t sample;
+   pattern_t pattern = { 0 };
+   siggen_init(&gen, timing, NULL, pixel, &pattern);
+   trace_init(t, &gen, fields, cpu_mhz);
+   int n = 0;
+   for (int f = 0; f < fields; f++) {
+      pattern.frame = f / 2;
+      for (int i = 0; i < t->samples_per_field; i++) {
+         siggen_next(&gen, &sample);
+         t->value[n] = sample.gplev0;
+         t->time[n] = (uint64_t) (sample.time_ns * cpu_mhz / 1000);
+         n++;
+      }
+   }
+}
+
+// A recorded trace has no times, so the edges are spaced evenly at the preset's clock
+static int trace_read(trace_t *t, const char *path, const siggen_timing_t *timing, double cpu_mhz) {
+   siggen_t gen;
+   FILE *f = fopen(path, "rb");
+   if (!f) {
+      perror(path);
+      return -1;
+   }
+   fseek(f, 0, SEEK_END);
+   int n = ftell(f) / sizeof(uint32_t);
+   fseek(f, 0, SEEK_SET);
+   siggen_init(&gen, timing, NULL, NULL, NULL);
+   trace_init(t, &gen, 0, cpu_mhz);
+   t->n = n;
+   t->value = realloc(t->value, n * sizeof(uint32_t));
+   t->time = realloc(t->time, n * sizeof(uint64_t));
+   if (fread(t->value, sizeof(uint32_t), n, f) != (size_t) n) {
+      fclose(f);
+      fprintf(stderr, "%s: read failed\n", path);
+      return -1;
+   }
+   fclose(f);
+   for (int i = 0; i < n; i++) {
+      t->time[i] = (uint64_t) (i * t->period);
+   }
+   return 0;
+}
+
+// =============================================================
+// Emulator
+// =============================================================
+
+typedef struct {
+   uc_engine *uc;
+   firmware_t *fw;
+   trace_t *trace;
+   uint32_t peripheral_base;
+   uint32_t cycle_counter_insn;  // READ_CYCLE_COUNTER with Rt = r0
+   int read_cycles;
+   uint64_t now;                 // CPU cycles
+   uint64_t instructions;        // in the current call
+   int cur;                      // last trace edge at or before now
+   int last;                     // trace edge returned by the last GPLEV0 read
+   int pending;                  // the last read returned a new edge whose busy time is still open
+   uint64_t edge_time;
+   int stuck;
+   int out_of_trace;
+   // Edges seen by the current call
+   int nedges;
+   uint32_t edge_value[MAX_EDGES];
+   uint32_t edge_busy[MAX_EDGES];   // cycles from the read that saw the edge to the next read
+   int edge_missed[MAX_EDGES];      // edges skipped over before this one
+} emu_t;
+
+static const int arm_regs[16] = {
+   UC_ARM_REG_R0, UC_ARM_REG_R1, UC_ARM_REG_R2, UC_ARM_REG_R3,
+   UC_ARM_REG_R4, UC_ARM_REG_R5, UC_ARM_REG_R6, UC_ARM_REG_R7,
+   UC_ARM_REG_R8, UC_ARM_REG_R9, UC_ARM_REG_R10, UC_ARM_REG_R11,
+   UC_ARM_REG_R12, UC_ARM_REG_SP, UC_ARM_REG_LR, UC_ARM_REG_PC
+};
+
+// One cycle per instruction, and the cycle counter reads return the model time
+static void hook_code(uc_engine *uc, uint64_t address, uint32_t size, void *user_data) {
+   emu_t *e = (emu_t *) user_data;
+   firmware_t *fw = e->fw;
+   (void) size;
+   e->now++;
+   if (++e->instructions > MAX_INSTRUCTIONS) {
+      e->stuck = 1;
+      uc_emu_stop(uc);
+      return;
+   }
+   uint32_t offset = (uint32_t) address - fw->base;
+   if (offset <= fw->size - 4) {
+      uint32_t insn;
+      memcpy(&insn, fw->image + offset, 4);
+      if ((insn & 0xffff0fff) == e->cycle_counter_insn) {
+         uint32_t value = (uint32_t) e->now;
+         uint32_t pc = (uint32_t) address + 4;
+         uc_reg_write(uc, arm_regs[(insn >> 12) & 15], &value);
+         uc_reg_write(uc, UC_ARM_REG_PC, &pc);
+      }
+   }
+}
+
+static void record_edge(emu_t *e, int missed) {
+   int slot = e->nedges % MAX_EDGES;
+   e->edge_value[slot] = e->trace->value[e->cur];
+   e->edge_busy[slot] = 0;
+   e->edge_missed[slot] = missed;
+   e->nedges++;
+   e->edge_time = e->now;
+   e->pending = 1;
+}
+
+static void close_edge(emu_t *e) {
+   if (e->pending && e->nedges) {
+      e->edge_busy[(e->nedges - 1) % MAX_EDGES] = (uint32_t) (e->now - e->edge_time);
+   }
+   e->pending = 0;
+}
+
+static uint64_t gpio_read(uc_engine *uc, uint64_t offset, unsigned size, void *user_data) {
+   emu_t *e = (emu_t *) user_data;
+   trace_t *t = e->trace;
+   (void) size;
+   if (offset != GPLEV0_OFFSET) {
+      return 0;
+   }
+   e->now += e->read_cycles;
+   while (e->cur + 1 < t->n && t->time[e->cur + 1] <= e->now) {
+      e->cur++;
+   }
+   close_edge(e);
+   if (e->cur == e->last) {
+      // Nothing new, so the function is waiting: skip ahead to the next edge
+      if (e->cur + 1 >= t->n) {
+         e->out_of_trace = 1;
+         uc_emu_stop(uc);
+         return t->value[e->cur];
+      }
+      e->cur++;
+      e->now = t->time[e->cur];
+   }
+   record_edge(e, e->cur - e->last - 1);
+   e->last = e->cur;
+   return t->value[e->cur];
+}
+
+static void gpio_write(uc_engine *uc, uint64_t offset, unsigned size, uint64_t value, void *user_data) {
+   (void) uc;
+   (void) offset;
+   (void) size;
+   (void) value;
+   (void) user_data;
+}
+
+// Other peripheral registers read as zero
+static bool hook_unmapped(uc_engine *uc, uc_mem_type type, uint64_t address, int size, int64_t value, void *user_data) {
+   emu_t *e = (emu_t *) user_data;
+   uint32_t pc;
+   (void) size;
+   (void) value;
+   if (address >= e->peripheral_base && address < (uint64_t) e->peripheral_base + 0x01000000) {
+      return uc_mem_map(uc, address & ~0xfffULL, 0x1000, UC_PROT_READ | UC_PROT_WRITE) == UC_ERR_OK;
+   }
+   uc_reg_read(uc, UC_ARM_REG_PC, &pc);
+   fprintf(stderr, "unmapped %s at 0x%08x (pc = 0x%08x)\n",
+           type == UC_MEM_FETCH_UNMAPPED ? "fetch" : type == UC_MEM_WRITE_UNMAPPED ? "write" : "read",
+           (uint32_t) address, pc);
+   return false;
+}
+
+static int check_uc(uc_err err, const char *what) {
+   if (err != UC_ERR_OK) {
+      fprintf(stderr, "%s: %s\n", what, uc_strerror(err));
+      return -1;
+   }
+   return 0;
+}
+
+static int emu_init(emu_t *e, firmware_t *fw, int pi, int read_cycles) {
+   uc_hook code_hook;
+   uc_hook unmapped_hook;
+   int model;
+   memset(e, 0, sizeof(emu_t));
+   e->fw = fw;
+   e->read_cycles = read_cycles;
+   switch (pi) {
+   case 1:
+      e->peripheral_base = 0x20000000;
+      e->cycle_counter_insn = 0xee1f0f3c;   // mrc p15, 0, r0, c15, c12, 1
+      model = UC_CPU_ARM_1176;
+      break;
+   case 2:
+      e->peripheral_base = 0x3F000000;
+      e->cycle_counter_insn = 0xee190f1d;   // mrc p15, 0, r0, c9, c13, 0
+      model = UC_CPU_ARM_CORTEX_A7;
+      break;
+   default:
+      e->peripheral_base = (pi == 4) ? 0xFE000000 : 0x3F000000;
+      e->cycle_counter_insn = 0xee190f1d;
+      model = UC_CPU_ARM_CORTEX_A15;        // the closest to the Cortex-A53/A72 in AArch32
+      break;
+   }
+   if (check_uc(uc_open(UC_ARCH_ARM, UC_MODE_ARM, &e->uc), "uc_open") ||
+       check_uc(uc_ctl_set_cpu_model(e->uc, model), "uc_ctl_set_cpu_model") ||
+       check_uc(uc_mem_map(e->uc, fw->base, fw->size, UC_PROT_ALL), "map firmware") ||
+       check_uc(uc_mem_write(e->uc, fw->base, fw->image, fw->size), "load firmware") ||
+       check_uc(uc_mem_map(e->uc, FB_BASE, 2 * FB_SIZE, UC_PROT_READ | UC_PROT_WRITE), "map frame buffer") ||
+       check_uc(uc_mem_map(e->uc, STACK_BASE, STACK_SIZE, UC_PROT_READ | UC_PROT_WRITE), "map stack") ||
+       check_uc(uc_mem_map(e->uc, RETURN_ADDRESS, 0x1000, UC_PROT_ALL), "map return address") ||
+       check_uc(uc_mmio_map(e->uc, e->peripheral_base + GPIO_OFFSET, 0x1000, gpio_read, e, gpio_write, e), "map GPIO") ||
+       check_uc(uc_hook_add(e->uc, &code_hook, UC_HOOK_CODE, hook_code, e, fw->base, fw->base + fw->size - 1), "code hook") ||
+       check_uc(uc_hook_add(e->uc, &unmapped_hook, UC_HOOK_MEM_UNMAPPED, hook_unmapped, e, 1, 0), "unmapped hook")) {
+      return -1;
+   }
+   return 0;
+}
+
+// Clears the frame buffer and the comparison buffer
+static void emu_clear(emu_t *e) {
+   static uint8_t zero[FB_PITCH];
+   for (uint32_t a = FB_BASE; a < FB_BASE + 2 * FB_SIZE; a += FB_PITCH) {
+      uc_mem_write(e->uc, a, zero, FB_PITCH);
+   }
+}
+
+// Starts the trace at the given edge, as if the function had just been called there
+static void emu_seek(emu_t *e, trace_t *t, int index) {
+   e->trace = t;
+   e->cur = index;
+   e->last = index;
+   e->now = t->time[index];
+   e->pending = 0;
+}
+
+// Calls a function with r0..r9 set up and returns when it returns, or -1 if it didn't
+static int emu_call(emu_t *e, uint32_t function, const uint32_t *regs) {
+   uint32_t sp = STACK_BASE + STACK_SIZE;
+   uint32_t lr = RETURN_ADDRESS;
+   uint32_t pc;
+   for (int i = 0; i < 10; i++) {
+      uc_reg_write(e->uc, arm_regs[i], &regs[i]);
+   }
+   uc_reg_write(e->uc, UC_ARM_REG_SP, &sp);
+   uc_reg_write(e->uc, UC_ARM_REG_LR, &lr);
+   e->nedges = 0;
+   e->instructions = 0;
+   e->stuck = 0;
+   e->out_of_trace = 0;
+   uc_err err = uc_emu_start(e->uc, function, RETURN_ADDRESS, 0, 0);
+   close_edge(e);
+   uc_reg_read(e->uc, UC_ARM_REG_PC, &pc);
+   if (err != UC_ERR_OK) {
+      fprintf(stderr, "emulation failed at 0x%08x: %s\n", pc, uc_strerror(err));
+      return -1;
+   }
+   if (e->stuck) {
+      fprintf(stderr, "function at 0x%08x didn't return after %d instructions\n", function, MAX_INSTRUCTIONS);
+      return -1;
+   }
+   if (e->out_of_trace) {
+      fprintf(stderr, "ran out of trace\n");
+      return -1;
+   }
+   if (pc != RETURN_ADDRESS) {
+      fprintf(stderr, "function at 0x%08x stopped at 0x%08x\n", function, pc);
+      return -1;
+   }
+   return 0;
+}
+
+// Returns edge i of the last n edges seen by the current call (oldest first), skipping trail edges at the end
+static int edge_slot(emu_t *e, int n, int trail, int i) {
+   return (e->nedges - trail - n + i) % MAX_EDGES;
+}
+
+// =============================================================
+// Psync budget
+// =============================================================
+
+typedef struct {
+   const char *name;
+   int sixbits;
+   int bpp;              // frame buffer bits per pixel
+   int check_bars;       // colour bars are checked (3 bit layouts of one or two pixels per byte)
+   int mode7;
+} kernel_t;
+
+static const kernel_t kernels[] = {
+   { "capture_line_default_4bpp",                0,  4, 1, 0 },
+   { "capture_line_default_8bpp",                0,  8, 1, 0 },
+   { "capture_line_default_16bpp",               0, 16, 0, 0 },
+   { "capture_line_inband_4bpp",                 0,  4, 0, 0 },
+   { "capture_line_inband_8bpp",                 0,  8, 0, 0 },
+   { "capture_line_default_double_4bpp",         0,  4, 0, 0 },
+   { "capture_line_default_double_8bpp",         0,  8, 0, 0 },
+   { "capture_line_fast_4bpp",                   0,  4, 1, 0 },
+   { "capture_line_fast_8bpp",                   0,  8, 1, 0 },
+   { "capture_line_odd_4bpp",                    0,  4, 0, 0 },
+   { "capture_line_odd_8bpp",                    0,  8, 0, 0 },
+   { "capture_line_even_4bpp",                   0,  4, 0, 0 },
+   { "capture_line_even_8bpp",                   0,  8, 0, 0 },
+   { "capture_line_half_odd_4bpp",               0,  4, 0, 0 },
+   { "capture_line_half_odd_8bpp",               0,  8, 0, 0 },
+   { "capture_line_half_even_4bpp",              0,  4, 0, 0 },
+   { "capture_line_half_even_8bpp",              0,  8, 0, 0 },
+   { "capture_line_mode7_4bpp",                  0,  4, 0, 1 },
+   { "capture_line_deinterlace_4bpp",            0,  4, 1, 0 },
+   { "capture_line_deinterlace_8bpp",            0,  8, 1, 0 },
+   { "capture_line_default_sixbits_4bpp",        1,  4, 0, 0 },
+   { "capture_line_default_sixbits_8bpp",        1,  8, 0, 0 },
+   { "capture_line_default_sixbits_16bpp",       1, 16, 0, 0 },
+   { "capture_line_ntsc_sixbits_4bpp",           1,  4, 0, 0 },
+   { "capture_line_ntsc_sixbits_8bpp",           1,  8, 0, 0 },
+   { "capture_line_default_sixbits_double_4bpp", 1,  4, 0, 0 },
+   { "capture_line_default_sixbits_double_8bpp", 1,  8, 0, 0 },
+   { "capture_line_fast_sixbits_4bpp",           1,  4, 0, 0 },
+   { "capture_line_fast_sixbits_8bpp",           1,  8, 0, 0 },
+   { "capture_line_deinterlace_sixbits_4bpp",    1,  4, 0, 0 },
+   { "capture_line_deinterlace_sixbits_8bpp",    1,  8, 0, 0 },
+   { NULL }
+};
+
+typedef struct {
+   int lines;
+   uint64_t line_cycles;
+   uint64_t busy_total;
+   uint32_t busy_worst;
+   int busy_edges;
+   int missed;
+} stats_t;
+
+// Accumulates the busy times of the last n edges of a line, and reports the line if verbose
+static void line_stats(emu_t *e, stats_t *s, int line, uint64_t start, int n, int trail) {
+   uint64_t total = 0;
+   uint32_t worst = 0;
+   int missed = 0;
+   if (n > e->nedges - trail) {
+      n = e->nedges - trail;
+   }
+   for (int i = 0; i < n; i++) {
+      int slot = edge_slot(e, n, trail, i);
+      total += e->edge_busy[slot];
+      if (e->edge_busy[slot] > worst) {
+         worst = e->edge_busy[slot];
+      }
+      // Missing the edge before the first captured one shifts the line too
+      missed += e->edge_missed[slot];
+   }
+   s->lines++;
+   s->line_cycles += e->now - start;
+   s->busy_total += total;
+   s->busy_edges += n;
+   s->missed += missed;
+   if (worst > s->busy_worst) {
+      s->busy_worst = worst;
+   }
+   if (verbose) {
+      printf("   line %3d: %6u cycles, psync mean %6.1f worst %5u, %d missed\n",
+             line, (uint32_t) (e->now - start), n ? (double) total / n : 0.0, worst, missed);
+   }
+}
+
+static int bar_pixel(emu_t *e, const kernel_t *k, uint32_t line_address, int x) {
+   uint8_t byte;
+   if (k->bpp == 4) {
+      uc_mem_read(e->uc, line_address + x / 2, &byte, 1);
+      return ((x & 1) ? byte : byte >> 4) & 7;
+   }
+   uc_mem_read(e->uc, line_address + x, &byte, 1);
+   return byte & 7;
+}
+
+// Checks the line shows the colour bars, allowing for the offset of the first captured pixel
+static int check_bars(emu_t *e, const kernel_t *k, const siggen_timing_t *timing, uint32_t line_address, int npixels) {
+   for (int d = -64; d <= 64; d++) {
+      int errors = 0;
+      int checked = 0;
+      for (int x = 0; x < npixels && errors == 0; x++) {
+         int sx = x + d;
+         if (sx >= 0 && sx < timing->h_active) {
+            errors += bar_pixel(e, k, line_address, x) != siggen_pixel_bars(NULL, sx, 0, 0);
+            checked++;
+         }
+      }
+      if (errors == 0 && checked >= npixels - 64) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+// The field type alternates, as the deinterlace functions write the line above in even fields
+static uint32_t kernel_flags(const kernel_t *k, int setting, int field) {
+   uint32_t flags = BIT_NO_SKIP_HSYNC | BIT_NO_H_SCROLL | ((field & 1) ? BIT_FIELD_TYPE : 0);
+   if (k->mode7) {
+      flags |= BIT_TELETEXT | (setting << OFFSET_INTERLACE);
+   }
+   return flags;
+}
+
+// Frame buffer line written by active line i of a field (mode 7 writes alternate lines of a frame),
+// leaving room above for the doubled line
+static uint32_t line_address(const kernel_t *k, uint32_t flags, int i) {
+   if (k->mode7) {
+      return FB_BASE + 2 * FB_PITCH + ((flags & BIT_FIELD_TYPE) ? 0 : FB_PITCH) + i * 2 * FB_PITCH;
+   }
+   return FB_BASE + 2 * FB_PITCH + i * 2 * FB_PITCH;
+}
+
+static void line_regs(emu_t *e, const siggen_timing_t *timing, const kernel_t *k, uint32_t flags, int i, uint32_t *regs) {
+   int pps = (timing->bpp == 6) ? 2 : 4;
+   int skip = (timing->h_active_start - timing->hsync_width) / pps;
+   regs[0] = line_address(k, flags, i);
+   regs[1] = timing->h_active / (2 * pps);     // psync cycles
+   regs[2] = FB_PITCH;
+   regs[3] = flags;
+   regs[4] = e->peripheral_base + GPIO_OFFSET + GPLEV0_OFFSET;
+   regs[5] = timing->v_active - i;
+   regs[6] = i % 10;
+   regs[7] = (skip > 0) ? skip : 1;
+   regs[8] = FB_SIZE;                          // offset to the comparison buffer
+   regs[9] = 0;                                // no hsync scrolling
+}
+
+// First edge of a field to replay from: just after the hsync of the line before the first active line
+static int field_start(trace_t *t, const siggen_timing_t *timing, int field) {
+   int pps = (timing->bpp == 6) ? 2 : 4;
+   return field * t->samples_per_field + (timing->v_active_start - 1) * t->samples_per_line + timing->hsync_width / pps + 2;
+}
+
+static void reset_motion_map(emu_t *e) {
+   uint32_t reset = find_symbol(e->fw, "motion_map_reset");
+   uint32_t regs[10] = { 0 };
+   if (reset) {
+      emu_call(e, reset, regs);
+   }
+}
+
+static void run_budget(emu_t *e, const kernel_t *k, uint32_t function, trace_t *t, const siggen_timing_t *timing,
+                       int fields, int margin, int recorded) {
+   stats_t s;
+   uint32_t regs[10];
+   int pps = (timing->bpp == 6) ? 2 : 4;
+   int bars_ok = 1;
+   int error = 0;
+
+   memset(&s, 0, sizeof(stats_t));
+   emu_clear(e);
+   reset_motion_map(e);
+   if (verbose) {
+      printf("%s on %s:\n", k->name, timing->name);
+   }
+   for (int f = 0; f < fields && !error; f++) {
+      uint32_t flags = kernel_flags(k, DEINTERLACE_ADV, f);
+      emu_seek(e, t, field_start(t, timing, f));
+      for (int i = 0; i < timing->v_active && !error; i++) {
+         uint64_t start = e->now;
+         line_regs(e, timing, k, flags, i, regs);
+         if (emu_call(e, function, regs) < 0) {
+            error = 1;
+            break;
+         }
+         line_stats(e, &s, i, start, 2 * regs[1], 0);
+      }
+   }
+   if (!error && k->check_bars && !recorded) {
+      int i = timing->v_active / 2;
+      bars_ok = check_bars(e, k, timing, line_address(k, 0, i), 2 * pps * (timing->h_active / (2 * pps)));
+   }
+
+   double budget = t->period;
+   double mean = s.busy_edges ? (double) s.busy_total / s.busy_edges : 0;
+   const char *result = "OK";
+   if (error) {
+      result = "ERROR";
+   } else if (s.missed) {
+      result = "MISSED";
+   } else if (s.busy_worst > budget * (100 + margin) / 100) {
+      result = "OVER";
+   } else if (!bars_ok) {
+      result = "PIXELS";
+   }
+   if (strcmp(result, "OK")) {
+      failures++;
+   }
+   printf("%-42s %-16s %8.0f %7.1f %7u %7.1f %6d  %s\n", k->name, timing->name,
+          s.lines ? (double) s.line_cycles / s.lines : 0.0, mean, s.busy_worst, budget, s.missed, result);
+}
+
+// =============================================================
+// Mode 7 reference check
+// =============================================================
+
+// Replays capture_line_mode7_4bpp and the C reference on the same trace for each
+// deinterlace setting, and compares the frame buffer and comparison buffer after
+// each field. The reference is given the words the captured edges make up.
+static void run_mode7_check(emu_t *e, uint32_t function, const siggen_timing_t *timing, int fields, double cpu_mhz) {
+   const kernel_t *k = NULL;
+   uint32_t regs[10];
+   trace_t t;
+   int nwords = timing->h_active / 8;
+   int trail = -1;           // edges read after the last captured one
+   uint32_t capture[MAX_EDGES / 2];
+   uint32_t rounding = find_symbol(e->fw, "rounding_lookup");
+   if (!rounding) {
+      printf("mode7 reference: rounding_lookup not found\n");
+      failures++;
+      return;
+   }
+   const uint8_t *rounding_lookup = e->fw->image + (rounding - e->fw->base);
+   uint32_t *fb_ref = malloc(FB_SIZE);
+   uint32_t *cmp_ref = malloc(FB_SIZE);
+   uint32_t *fb = malloc(FB_SIZE);
+   uint32_t *cmp = malloc(FB_SIZE);
+
+   for (const kernel_t *kk = kernels; kk->name; kk++) {
+      if (kk->mode7) {
+         k = kk;
+      }
+   }
+   trace_generate(&t, timing, pixel_teletext, fields, cpu_mhz);
+
+   for (int setting = DEINTERLACE_NONE; setting <= DEINTERLACE_ADV_MAP; setting++) {
+      int ncaptured = (setting >= DEINTERLACE_ADV) ? (nwords + 2) / 3 * 3 : nwords;
+      int fb_errors = 0;
+      int cmp_errors = 0;
+      int error = 0;
+      char first[128] = "";
+
+      emu_clear(e);
+      reset_motion_map(e);
+      memset(fb_ref, 0, FB_SIZE);
+      memset(cmp_ref, 0, FB_SIZE);
+      for (int f = 0; f < fields && !error; f++) {
+         uint32_t flags = kernel_flags(k, setting, f);
+         emu_seek(e, &t, field_start(&t, timing, f));
+         for (int i = 0; i < timing->v_active; i++) {
+            line_regs(e, timing, k, flags, i, regs);
+            if (emu_call(e, function, regs) < 0) {
+               error = 1;
+               break;
+            }
+            // The first line shows how many edges the function reads after its last captured word
+            if (trail < 0) {
+               uint32_t line[MAX_EDGES / 2];
+               uc_mem_read(e->uc, regs[0], line, nwords * 4);
+               for (int n = 0; n < 4 && trail < 0 && e->nedges - n >= 2 * nwords; n++) {
+                  int w;
+                  for (w = 0; w < nwords; w++) {
+                     uint32_t word = mode7_ref_capture_word(e->edge_value[edge_slot(e, 2 * nwords, n, 2 * w)],
+                                                            e->edge_value[edge_slot(e, 2 * nwords, n, 2 * w + 1)]);
+                     if ((line[w] & 0x77777777) != word) {
+                        break;
+                     }
+                  }
+                  if (w == nwords) {
+                     trail = n;
+                  }
+               }
+               if (trail < 0) {
+                  printf("mode7 reference: can't line up the captured words with the trace\n");
+                  failures++;
+                  error = 1;
+                  break;
+               }
+            }
+            for (int w = 0; w < ncaptured; w++) {
+               capture[w] = mode7_ref_capture_word(e->edge_value[edge_slot(e, 2 * ncaptured, trail, 2 * w)],
+                                                   e->edge_value[edge_slot(e, 2 * ncaptured, trail, 2 * w + 1)]);
+            }
+            int offset = (regs[0] - FB_BASE) / 4;
+            mode7_ref_line(capture, nwords, fb_ref + offset, cmp_ref + offset, FB_PITCH / 4, flags, regs[6], rounding_lookup);
+         }
+         if (error) {
+            break;
+         }
+         uc_mem_read(e->uc, FB_BASE, fb, FB_SIZE);
+         uc_mem_read(e->uc, FB_BASE + FB_SIZE, cmp, FB_SIZE);
+         for (int i = 0; i < FB_SIZE / 4; i++) {
+            if (fb[i] != fb_ref[i] || cmp[i] != cmp_ref[i]) {
+               if (!first[0]) {
+                  snprintf(first, sizeof(first), " (first at field %d line %d word %d: fb %08x/%08x, cmp %08x/%08x)",
+                           f, i / (FB_PITCH / 4), i % (FB_PITCH / 4), fb[i], fb_ref[i], cmp[i], cmp_ref[i]);
+               }
+               fb_errors += fb[i] != fb_ref[i];
+               cmp_errors += cmp[i] != cmp_ref[i];
+            }
+         }
+      }
+      const char *result = error ? "ERROR" : (fb_errors || cmp_errors) ? "DIFFERENT" : "OK";
+      if (strcmp(result, "OK")) {
+         failures++;
+      }
+      printf("mode7 reference, deinterlace %d: %d fb and %d cmp words differ  %s%s\n",
+             setting, fb_errors, cmp_errors, result, first);
+   }
+   trace_free(&t);
+   free(fb_ref);
+   free(cmp_ref);
+   free(fb);
+   free(cmp);
+}
+
+// =============================================================
+// Capture line function choice
+// =============================================================
+
+typedef struct {
+   int bpp;
+   int sizex2;
+   int palette_control;
+   uint32_t flags;
+   uint32_t index;       // expected index into the param_capture_line table
+   const char *what;
+} choice_t;
+
+#define CHOICE_FLAGS (BIT_INTERLACED | BIT_NO_SCANLINES | BIT_NO_H_SCROLL)
+#define CHOICE_MA1   (CHOICE_FLAGS | (DEINTERLACE_MA1 << OFFSET_INTERLACE))
+#define CHOICE_BOB   (CHOICE_FLAGS | (DEINTERLACE_BOB << OFFSET_INTERLACE))
+
+static const choice_t choices[] = {
+   {  4, 1, 0, CHOICE_MA1, 15, "4bpp motion adaptive" },
+   {  8, 1, 0, CHOICE_MA1, 16, "8bpp motion adaptive" },
+   { 16, 1, 0, CHOICE_MA1, 14, "16bpp motion adaptive (there are no 16bpp deinterlace functions)" },
+   {  4, 1, 0, CHOICE_BOB,  0, "4bpp bob" },
+   {  8, 1, 1, CHOICE_MA1, 3, "8bpp motion adaptive with in band palette control" },
+   {  8, 0, 0, CHOICE_MA1, 13, "8bpp motion adaptive without line doubling" },
+   { 0 }
+};
+
+// Calls choose_capture_line in rgb_to_fb.S with the parameters it reads set up
+static void run_choice_check(emu_t *e) {
+   uint32_t choose = find_symbol(e->fw, "choose_capture_line");
+   uint32_t bpp = find_symbol(e->fw, "param_fb_bpp");
+   uint32_t sizex2 = find_symbol(e->fw, "param_fb_sizex2");
+   uint32_t palette_control = find_symbol(e->fw, "param_palette_control");
+   if (!choose || !bpp || !sizex2 || !palette_control) {
+      printf("choose_capture_line: not in this build\n");
+      return;
+   }
+   for (const choice_t *c = choices; c->bpp; c++) {
+      uint32_t regs[10] = { 0 };
+      uint32_t index;
+      uc_mem_write(e->uc, bpp, &c->bpp, 4);
+      uc_mem_write(e->uc, sizex2, &c->sizex2, 4);
+      uc_mem_write(e->uc, palette_control, &c->palette_control, 4);
+      regs[3] = c->flags;
+      if (emu_call(e, choose, regs) < 0) {
+         failures++;
+         continue;
+      }
+      uc_reg_read(e->uc, UC_ARM_REG_R7, &index);
+      if (index != c->index) {
+         printf("choose_capture_line, %s: index %u, expected %u  FAIL\n", c->what, index, c->index);
+         failures++;
+      }
+   }
+}
+
+// =============================================================
+// Main
+// =============================================================
+
+static void usage() {
+   fprintf(stderr, "usage: capture_replay [-p pi] [-c mhz] [-r cycles] [-m percent] [-k name] [-s preset]\n"
+                   "                      [-t trace] [-w trace] [-f fields] [-v] firmware.elf\n");
+   exit(2);
+}
+
+int main(int argc, char **argv) {
+   int pi = 2;
+   double cpu_mhz = 1000;
+   int read_cycles = 40;
+   int margin = 10;
+   int fields = 2;
+   const char *only = NULL;
+   const char *preset = NULL;
+   const char *trace_in = NULL;
+   const char *trace_out = NULL;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "p:c:r:m:k:s:t:w:f:v")) != -1) {
+      switch (opt) {
+      case 'p': pi = atoi(optarg); break;
+      case 'c': cpu_mhz = atof(optarg); break;
+      case 'r': read_cycles = atoi(optarg); break;
+      case 'm': margin = atoi(optarg); break;
+      case 'k': only = optarg; break;
+      case 's': preset = optarg; break;
+      case 't': trace_in = optarg; break;
+      case 'w': trace_out = optarg; break;
+      case 'f': fields = atoi(optarg); break;
+      case 'v': verbose = 1; break;
+      default: usage();
+      }
+   }
+   if (pi < 1 || pi > 4 || cpu_mhz <= 0 || fields < 1) {
+      usage();
+   }
+   if (preset && !siggen_find_preset(preset)) {
+      fprintf(stderr, "unknown preset %s\n", preset);
+      return 2;
+   }
+
+   if (trace_out) {
+      trace_t t;
+      const siggen_timing_t *timing = siggen_find_preset(preset ? preset : "BBC_Micro");
+      trace_generate(&t, timing, siggen_pixel_bars, fields, cpu_mhz);
+      FILE *f = fopen(trace_out, "wb");
+      if (!f || fwrite(t.value, sizeof(uint32_t), t.n, f) != (size_t) t.n) {
+         perror(trace_out);
+         return 2;
+      }
+      fclose(f);
+      printf("wrote %d fields of %s (%d psync edges) to %s\n", fields, timing->name, t.n, trace_out);
+      return 0;
+   }
+
+   if (optind != argc - 1) {
+      usage();
+   }
+   firmware_t fw;
+   if (load_firmware(&fw, argv[optind]) < 0) {
+      return 2;
+   }
+   if (find_symbol(&fw, "core1_request")) {
+      printf("%s is a USE_MULTICORE build: core 1 isn't emulated, so nothing was checked\n", argv[optind]);
+      return 0;
+   }
+   emu_t e;
+   if (emu_init(&e, &fw, pi, read_cycles) < 0) {
+      return 2;
+   }
+
+   printf("Pi %d at %.0fMHz, %d cycles per GPLEV0 read, margin %d%%\n", pi, cpu_mhz, read_cycles, margin);
+   printf("%-42s %-16s %8s %7s %7s %7s %6s  %s\n", "Function", "Source", "Line", "Mean", "Worst", "Budget", "Missed", "Result");
+
+   // Each preset is generated once and shared by the functions that use it
+   const siggen_timing_t *timings[3];
+   trace_t traces[3];
+   memset(traces, 0, sizeof(traces));
+   timings[0] = siggen_find_preset(preset ? preset : "BBC_Micro");
+   timings[1] = siggen_find_preset(preset ? preset : "VGA_Graphics");
+   timings[2] = siggen_find_preset("BBC_Micro_Mode7");
+
+   for (const kernel_t *k = kernels; k->name; k++) {
+      if (only && strcmp(only, k->name)) {
+         continue;
+      }
+      uint32_t function = find_symbol(&fw, k->name);
+      if (!function) {
+         printf("%-42s not in this build\n", k->name);
+         continue;
+      }
+      int index = k->mode7 ? 2 : k->sixbits ? 1 : 0;
+      const siggen_timing_t *timing = timings[index];
+      if (!traces[index].n) {
+         if (trace_in && !k->mode7) {
+            if (trace_read(&traces[index], trace_in, timing, cpu_mhz) < 0) {
+               return 2;
+            }
+         } else {
+            trace_generate(&traces[index], timing, k->mode7 ? pixel_teletext : siggen_pixel_bars, fields, cpu_mhz);
+         }
+      }
+      run_budget(&e, k, function, &traces[index], timing, fields, margin, trace_in && !k->mode7);
+      if (k->mode7) {
+         run_mode7_check(&e, function, timing, fields < 4 ? 4 : fields, cpu_mhz);
+      }
+   }
+
+   run_choice_check(&e);
+
+   for (int i = 0; i < 3; i++) {
+      trace_free(&traces[i]);
+   }
+   uc_close(e.uc);
+   if (failures) {
+      printf("%d checks failed\n", failures);
+      return 1;
+   }
+   printf("All checks passed\n");
+   return 0;
+}
@@ -0,0 +1,211 @@
+// Genlock simulator
+//
+// Runs the genlock controllers from genlock.c against a model of the source
+// and display clocks, to compare the time to lock after a mode change, the
+// steady state phase error and the number of resyncs.
+//
+// Build and run on the host (from src/scripts):
+//    gcc -O2 -Wall -Wextra -I.. -o genlock_sim genlock_sim.c ../genlock.c -lm
+//    ./genlock_sim [runs]
+//
+// The model follows recalculate_hdmi_clock: when the controller changes its
+// adjustment, the display field rate is set to the measured source field rate
+// slowed by the adjustment (rounded to the PLLH fractional divider), and stays
+// there until the next change. Each field the display vsync moves relative to
+// the source frame by the difference between the two field periods. The
+// source field rate drifts away from the value measured at the mode change,
+// and the measured difference is rounded to whole lines plus some jitter.
+// As in the firmware, an unlock restarts the capture, which re-measures the
+// source and forces the HDMI clock to be recalculated.
+//
+// The re-entry scenarios return to a mode the genlock cache has seen before,
+// such as a profile change or a switch in and out of teletext, where the
+// source keeps running so the phase is still close to where it was locked.
+// Only the source is re-measured, so without the cache the controller has to
+// find the frequency again. The warm start scenarios seed the controller
+// with the frequency error of the measurement, to within the error of the
+// cached source frequency.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "defs.h"
+#include "genlock.h"
+
+#define FIELD_RATE    50.0
+#define PLLH_QUANTUM  (1.0 / (56.0 * (1 << 20)))   // relative resolution of PLLH at a typical divider
+#define FIELDS        6000                          // two minutes
+
+enum {
+   START_LOCKED,           // locked
+   START_RANDOM,           // anywhere in the frame, as after a change of source timing
+   START_NEAR              // unlocked, but within a couple of lines of the locked phase
+};
+
+typedef struct {
+   const char *name;
+   int lines;              // lines per field (in the units the difference is measured in)
+   int start;              // the phase at the start of the run
+   double measure_ppm;     // worst case error of the measured source rate
+   double ramp_ppm;        // source drift over the run
+   double wander_ppm;      // amplitude of a slow sinusoidal source wander...
+   double wander_period;   // ...with this period in seconds
+   double jitter_lines;    // worst case jitter of the measured difference
+   double seed_ppm;        // if non-zero, seeded from the genlock cache to within this
+} scenario_t;
+
+typedef struct {
+   const char *name;
+   int max_steps;
+   int locked_threshold;
+   int frame_delay;
+} speed_t;
+
+typedef struct {
+   int runs;
+   int locked_runs;
+   double lock_fields;     // sum over the runs that locked
+   int worst_lock_fields;
+   double sum_sq_phase;    // after the first lock
+   int phase_samples;
+   double max_phase;
+   int resyncs;
+   int unlocks;
+   int changes;
+} result_t;
+
+static const scenario_t scenarios[] = {
+   { "mode change",        312, START_RANDOM,  50,   0,  0,  0, 0.0, 0 },
+   { "mode change NTSC",   262, START_RANDOM,  50,   0,  0,  0, 0.0, 0 },
+   { "drifting source",    312, START_LOCKED,  20,  40, 15, 20, 0.3, 0 },
+   { "noisy vsync",        312, START_LOCKED,  20,   5,  2, 30, 2.0, 0 },
+   { "drift after change", 312, START_RANDOM, 100,  60, 20, 15, 0.5, 0 },
+   { "re-entry",           312, START_NEAR,    50,   0,  0,  0, 0.3, 0 },
+   { "re-entry warm",      312, START_NEAR,    50,   0,  0,  0, 0.3, 2 },
+   { "change warm",        312, START_RANDOM,  50,   0,  0,  0, 0.0, 2 }
+};
+
+static const speed_t speeds[] = {
+   { "fast",   GENLOCK_MAX_STEPS,      GENLOCK_LOCKED_THRESHOLD,     GENLOCK_FRAME_DELAY      },
+   { "medium", GENLOCK_MAX_STEPS >> 1, GENLOCK_LOCKED_THRESHOLD - 1, GENLOCK_FRAME_DELAY << 1 },
+   { "slow",   1,                      1,                            GENLOCK_FRAME_DELAY << 1 }
+};
+
+static const char *controller_names[] = { "stepper", "PI" };
+
+static double uniform(double range) {
+   return range * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+// The source field rate relative to nominal at field k
+static double source_rate(const scenario_t *sc, int k, double offset_ppm) {
+   double t = k / FIELD_RATE;
+   double ppm = offset_ppm + sc->ramp_ppm * k / FIELDS;
+   if (sc->wander_period > 0) {
+      ppm += sc->wander_ppm * sin(2 * M_PI * t / sc->wander_period);
+   }
+   return 1.0 + ppm * 1e-6;
+}
+
+static void simulate(const scenario_t *sc, const speed_t *sp, int controller, result_t *res) {
+   genlock_t genlock;
+   genlock_init(&genlock, controller);
+   genlock_configure(&genlock, sp->max_steps, sp->locked_threshold, sp->frame_delay, sc->lines);
+
+   double offset_ppm = uniform(100);
+   double phase = 0;
+   if (sc->start == START_RANDOM) {
+      phase = uniform(sc->lines / 2.0);
+   } else if (sc->start == START_NEAR) {
+      phase = uniform(2.0);
+   }
+   double measured = source_rate(sc, 0, offset_ppm) * (1.0 + uniform(sc->measure_ppm) * 1e-6);
+   double display = measured;
+   int force = 1;
+   if (sc->seed_ppm != 0) {
+      genlock_seed(&genlock, (measured / source_rate(sc, 0, offset_ppm) - 1.0) * 1e6 + uniform(sc->seed_ppm));
+   }
+   int first_lock = (sc->start == START_LOCKED) ? 0 : -1;
+   if (sc->start == START_LOCKED) {
+      genlock.locked = 1;
+   }
+
+   for (int k = 0; k < FIELDS; k++) {
+      double source = source_rate(sc, k, offset_ppm);
+      // The display vsync moves by the difference in field periods, in lines
+      phase -= sc->lines * (source / display - 1.0);
+      if (phase > sc->lines / 2.0) {
+         phase -= sc->lines;
+      } else if (phase < -sc->lines / 2.0) {
+         phase += sc->lines;
+      }
+      int difference = (int) lround(phase + uniform(sc->jitter_lines));
+
+      int events = genlock_update(&genlock, difference, force);
+      force = 0;
+      if (events & GENLOCK_LOCKED && first_lock < 0) {
+         first_lock = k;
+      }
+      if (events & GENLOCK_RESYNC) {
+         res->resyncs++;
+      }
+      if (events & GENLOCK_UNLOCK) {
+         res->unlocks++;
+         // The capture restarts, re-measuring the source rate
+         measured = source * (1.0 + uniform(sc->measure_ppm) * 1e-6);
+         genlock.target = 0;
+         genlock.resync_count = 0;
+         force = 1;
+      }
+      if (events & GENLOCK_CHANGED) {
+         res->changes++;
+         double rate = measured / (1.0 + genlock_ppm(&genlock) * 1e-6);
+         display = PLLH_QUANTUM * floor(rate / PLLH_QUANTUM + 0.5);
+      }
+      genlock_tick(&genlock);
+
+      if (first_lock >= 0) {
+         res->sum_sq_phase += phase * phase;
+         res->phase_samples++;
+         if (fabs(phase) > res->max_phase) {
+            res->max_phase = fabs(phase);
+         }
+      }
+   }
+   res->runs++;
+   if (first_lock >= 0) {
+      res->locked_runs++;
+      res->lock_fields += first_lock;
+      if (first_lock > res->worst_lock_fields) {
+         res->worst_lock_fields = first_lock;
+      }
+   }
+}
+
+int main(int argc, char **argv) {
+   int runs = (argc > 1) ? atoi(argv[1]) : 100;
+   double minutes = runs * FIELDS / FIELD_RATE / 60.0;
+
+   printf("%d runs of %d fields for each case\n\n", runs, FIELDS);
+   printf("%-19s %-6s %-7s | %6s %8s %8s | %6s %6s | %8s %8s %8s\n", "scenario", "speed", "control",
+          "locked", "mean s", "worst s", "rms", "max", "resync/m", "unlock/m", "writes/m");
+   for (int i = 0; i < (int) (sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+      for (int j = 0; j < (int) (sizeof(speeds) / sizeof(speeds[0])); j++) {
+         for (int controller = GENLOCK_STEPPER; controller <= GENLOCK_PI; controller++) {
+            result_t res = { 0 };
+            srand(i * 1000 + j + 1);   // both controllers see the same sources
+            for (int r = 0; r < runs; r++) {
+               simulate(&scenarios[i], &speeds[j], controller, &res);
+            }
+            printf("%-19s %-6s %-7s | %5.0f%% %8.2f %8.2f | %6.2f %6.1f | %8.2f %8.2f %8.1f\n",
+                   scenarios[i].name, speeds[j].name, controller_names[controller],
+                   100.0 * res.locked_runs / res.runs,
+                   res.locked_runs ? res.lock_fields / res.locked_runs / FIELD_RATE : 0,
+                   res.worst_lock_fields / FIELD_RATE,
+                   res.phase_samples ? sqrt(res.sum_sq_phase / res.phase_samples) : 0, res.max_phase,
+                   res.resyncs / minutes, res.unlocks / minutes, res.changes / minutes);
+         }
+      }
+   }
+   return 0;
+}
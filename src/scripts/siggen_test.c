@@ -0,0 +1,204 @@
+// Signal generator test
+//
+// Decodes the samples from siggen.c the way the capture code sees them
+// (psync edges, csync and vsync levels, and the pixel bits of GPLEV0) and
+// checks them against each preset timing and the impairment settings.
+//
+// Build and run on the host (from src/scripts):
+//    gcc -O2 -Wall -Wextra -I.. -o siggen_test siggen_test.c ../siggen.c
+//    ./siggen_test
+//
+// It exits with a non-zero status if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "siggen.h"
+
+static int failures = 0;
+
+static void check(int ok, const char *name, const char *what) {
+   if (!ok) {
+      printf("FAIL %s: %s\n", name, what);
+      failures++;
+   }
+}
+
+static int pixels_per_sample(const siggen_timing_t *t) {
+   return (t->bpp == 6) ? 2 : 4;
+}
+
+static int hsync_active(const siggen_timing_t *t, siggen_sample_t *sample) {
+   return !(sample->gplev0 & CSYNC_MASK) != !!(t->sync_type & SYNC_BIT_HSYNC_INVERTED);
+}
+
+static int vsync_active(const siggen_timing_t *t, siggen_sample_t *sample) {
+   return sample->vsync == !!(t->sync_type & SYNC_BIT_VSYNC_INVERTED);
+}
+
+typedef struct {
+   int samples;
+   int psync_repeats;      // samples where psync didn't change
+   int vsync_edges;
+   double field_ns;        // time between the last two vsync leading edges
+   int line_edges;         // hsync leading edges outside vsync
+   int min_line;           // samples between hsync leading edges outside vsync
+   int max_line;
+   int pixel_errors;       // colour bar pixels that don't match, on one line of the first field
+   int pixels_checked;
+} decode_t;
+
+static void decode(siggen_t *gen, int fields, decode_t *d) {
+   const siggen_timing_t *t = &gen->timing;
+   int pps = pixels_per_sample(t);
+   int bits = (t->bpp == 6) ? 6 : 3;
+   int check_line = t->v_active_start + t->v_active / 2;
+   int last_psync = -1;
+   int last_hsync = 0;
+   int last_vsync = 0;
+   int last_edge = -1;
+   int line = -1;          // line of the first field, counted from the start of vsync
+   int line_sample = 0;    // samples since the hsync leading edge of that line
+   double last_vsync_ns = -1;
+   siggen_sample_t sample;
+
+   memset(d, 0, sizeof(decode_t));
+   d->min_line = 1 << 30;
+   d->max_line = 0;
+   int total = fields * siggen_samples_per_field(gen);
+   for (int n = 0; n < total; n++) {
+      siggen_next(gen, &sample);
+      int psync = !!(sample.gplev0 & PSYNC_MASK);
+      int hsync = hsync_active(t, &sample);
+      int vsync = vsync_active(t, &sample);
+      d->samples++;
+      if (psync == last_psync) {
+         d->psync_repeats++;
+      }
+      last_psync = psync;
+      if (vsync && !last_vsync) {
+         if (last_vsync_ns >= 0) {
+            d->field_ns = sample.time_ns - last_vsync_ns;
+         }
+         last_vsync_ns = sample.time_ns;
+         d->vsync_edges++;
+      }
+      if (hsync && !last_hsync && !vsync) {
+         if (last_edge >= 0) {
+            int len = n - last_edge;
+            if (len < d->min_line) {
+               d->min_line = len;
+            }
+            if (len > d->max_line) {
+               d->max_line = len;
+            }
+         }
+         last_edge = n;
+         d->line_edges++;
+         if (d->vsync_edges == 1) {
+            line = (line < 0) ? t->vsync_lines : line + 1;
+            line_sample = 0;
+         }
+      }
+      last_hsync = hsync;
+      last_vsync = vsync;
+      if (vsync) {
+         last_edge = -1;
+      }
+      // Colour bars on one line in the middle of the first field's active area
+      if (line == check_line && d->vsync_edges == 1) {
+         for (int i = 0; i < pps; i++) {
+            int x = line_sample * pps - t->h_active_start + i;
+            if (x >= 0 && x < t->h_active) {
+               int pixel = (sample.gplev0 >> (PIXEL_BASE + i * bits)) & ((1 << bits) - 1);
+               d->pixel_errors += pixel != siggen_pixel_bars(NULL, x, 0, 0);
+               d->pixels_checked++;
+            }
+         }
+      }
+      line_sample++;
+   }
+}
+
+static void test_preset(const siggen_timing_t *t) {
+   siggen_t gen;
+   decode_t d;
+   int pps = pixels_per_sample(t);
+   siggen_init(&gen, t, NULL, siggen_pixel_bars, NULL);
+   decode(&gen, 4, &d);
+
+   double line_ns = (double) t->line_len * 1e9 / t->clock;
+   double expected_field_ns = (2 * t->lines_per_frame + (t->interlaced ? 1 : 0)) * line_ns / 2;
+   int expected_line = t->line_len / pps;
+
+   check(d.psync_repeats == 0, t->name, "psync missed an edge");
+   check(d.vsync_edges == 4, t->name, "wrong number of fields");
+   check(d.field_ns > expected_field_ns - line_ns && d.field_ns < expected_field_ns + line_ns, t->name, "wrong field period");
+   check(d.min_line >= expected_line - 1 && d.max_line <= expected_line + 1, t->name, "wrong line length");
+   check(d.pixels_checked == t->h_active, t->name, "active line is the wrong length");
+   check(d.pixel_errors == 0, t->name, "colour bars decoded wrongly");
+   printf("%-16s field %8.1f us  line %4d..%4d samples  %d pixels checked\n",
+          t->name, d.field_ns / 1000, d.min_line, d.max_line, d.pixels_checked);
+}
+
+static void test_impairments() {
+   const siggen_timing_t *t = siggen_find_preset("VGA_Graphics");
+   int pps = pixels_per_sample(t);
+   siggen_t gen;
+   decode_t d;
+
+   check(t != NULL, "impairments", "preset not found");
+   if (t == NULL) {
+      return;
+   }
+
+   // Jitter moves each hsync edge by up to the peak, so the spacing varies by up to twice that
+   siggen_impairments_t jitter = { .jitter_ns = 200, .seed = 1 };
+   int peak = (int)((double) jitter.jitter_ns * t->clock / 1e9 + 0.5);
+   int spread = (2 * peak + pps - 1) / pps + 1;
+   siggen_init(&gen, t, &jitter, NULL, NULL);
+   decode(&gen, 2, &d);
+   check(d.max_line > d.min_line, "jitter", "hsync edges didn't move");
+   check(d.min_line >= t->line_len / pps - spread && d.max_line <= t->line_len / pps + spread, "jitter", "hsync edges moved too far");
+
+   // Every hsync pulse dropped
+   siggen_impairments_t dropout = { .dropout_rate = 65536, .seed = 1 };
+   siggen_init(&gen, t, &dropout, NULL, NULL);
+   decode(&gen, 2, &d);
+   check(d.line_edges == 0, "dropout", "hsync pulses weren't dropped");
+
+   // About one psync glitch per 256 samples
+   siggen_impairments_t glitch = { .glitch_rate = 256, .seed = 1 };
+   siggen_init(&gen, t, &glitch, NULL, NULL);
+   decode(&gen, 2, &d);
+   check(d.psync_repeats > d.samples / 512 && d.psync_repeats < d.samples / 128, "glitch", "wrong number of psync glitches");
+
+   // The same seed gives the same samples
+   siggen_t a;
+   siggen_t b;
+   siggen_sample_t sa;
+   siggen_sample_t sb;
+   int same = 1;
+   siggen_init(&a, t, &glitch, NULL, NULL);
+   siggen_init(&b, t, &glitch, NULL, NULL);
+   for (int n = 0; n < siggen_samples_per_field(&a); n++) {
+      siggen_next(&a, &sa);
+      siggen_next(&b, &sb);
+      same &= sa.gplev0 == sb.gplev0 && sa.vsync == sb.vsync;
+   }
+   check(same, "seed", "the same seed gave different samples");
+}
+
+int main() {
+   for (const siggen_timing_t *t = siggen_presets; t->name; t++) {
+      test_preset(t);
+   }
+   test_impairments();
+   if (failures) {
+      printf("%d checks failed\n", failures);
+      return 1;
+   }
+   printf("All checks passed\n");
+   return 0;
+}
@@ -0,0 +1,173 @@
+#include <string.h>
+#include "defs.h"
+#include "siggen.h"
+
+// =============================================================
+// Presets
+// =============================================================
+
+// Timings are taken from the profiles in scripts/Profiles and from
+// scripts/pc timings.txt. The active windows are approximate.
+
+const siggen_timing_t siggen_presets[] = {
+   //  name               clock     len  lines  sync                                          int  hsw  vsl  h_start h_act v_start v_act bpp
+   { "BBC_Micro",        16000000, 1024, 312, SYNC_BIT_COMPOSITE_SYNC,                         0,  64,   2,   240,   640,   40,   256,   3 },
+   { "BBC_Micro_Mode7",  12000000,  768, 312, SYNC_BIT_COMPOSITE_SYNC,                         1,  48,   2,   156,   480,   42,   250,   3 },
+   { "Electron",         16000000, 1024, 312, SYNC_BIT_COMPOSITE_SYNC,                         0,  64,   3,   240,   640,   40,   256,   3 },
+   { "Atom",              7159090,  456, 262, SYNC_BIT_COMPOSITE_SYNC,                         0,  34,   3,    80,   256,   36,   192,   6 },
+   { "VGA_Text",         28322000,  900, 449, SYNC_BIT_VSYNC_INVERTED,                         0, 108,   2,   162,   720,   37,   400,   6 },
+   { "EGA_on_VGA",       25175000,  800, 449, SYNC_BIT_HSYNC_INVERTED,                         0,  96,   2,   144,   640,   37,   350,   6 },
+   { "CGA_on_VGA",       28322000,  891, 449, SYNC_BIT_VSYNC_INVERTED,                         0, 108,   2,   162,   640,   37,   400,   6 },
+   { "VGA_Graphics",     25175000,  800, 525, 0,                                               0,  96,   2,   144,   640,   35,   480,   6 },
+   { "EGA",              16257000,  744, 365, SYNC_BIT_HSYNC_INVERTED,                         0,  64,   2,   104,   640,   13,   350,   6 },
+   { "CGA",              14318181,  912, 262, SYNC_BIT_HSYNC_INVERTED | SYNC_BIT_VSYNC_INVERTED, 0,  64,   3,   150,   640,   36,   200,   6 },
+   { "MDA",              16257000,  882, 370, SYNC_BIT_HSYNC_INVERTED | SYNC_BIT_VSYNC_INVERTED, 0, 128,  16,   150,   720,   18,   350,   6 },
+   { NULL }
+};
+
+const siggen_timing_t *siggen_find_preset(const char *name) {
+   for (const siggen_timing_t *preset = siggen_presets; preset->name; preset++) {
+      if (strcmp(preset->name, name) == 0) {
+         return preset;
+      }
+   }
+   return NULL;
+}
+
+// =============================================================
+// Private methods
+// =============================================================
+
+// xorshift32
+static uint32_t siggen_rand(siggen_t *gen) {
+   uint32_t x = gen->rand;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   gen->rand = x;
+   return x;
+}
+
+static int siggen_chance(siggen_t *gen, int rate) {
+   return rate > 0 && (int)(siggen_rand(gen) & 0xffff) < rate;
+}
+
+// Called at the start of each line to roll the impairments for that line
+static void siggen_new_line(siggen_t *gen) {
+   int jitter = (int)((double)gen->impairments.jitter_ns * gen->timing.clock / 1e9 + 0.5);
+   gen->line_offset = (jitter > 0) ? (int)(siggen_rand(gen) % (2 * jitter + 1)) : 0;
+   gen->line_dropped = siggen_chance(gen, gen->impairments.dropout_rate);
+}
+
+// Returns the level of the composite/horizontal sync and vertical sync
+// (1 = sync active) at the given clock within the current half line
+static void siggen_syncs(siggen_t *gen, int clock, int line_start, int *hsync, int *vsync) {
+   const siggen_timing_t *t = &gen->timing;
+   int half_len = t->line_len >> 1;
+   int in_vsync = gen->half_line < 2 * t->vsync_lines;
+   int pulse = line_start && !gen->line_dropped && clock >= gen->line_offset && clock < gen->line_offset + t->hsync_width;
+   *vsync = in_vsync;
+   if ((t->sync_type & SYNC_BIT_COMPOSITE_SYNC) && in_vsync) {
+      // Broad pulses, serrated by a pulse of hsync width at the end of each half line
+      *hsync = clock < half_len - t->hsync_width;
+   } else {
+      *hsync = pulse;
+   }
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void siggen_init(siggen_t *gen, const siggen_timing_t *timing, const siggen_impairments_t *impairments, siggen_pixel_fn pixel, void *context) {
+   memset(gen, 0, sizeof(siggen_t));
+   gen->timing = *timing;
+   if (impairments) {
+      gen->impairments = *impairments;
+   }
+   gen->pixel = pixel ? pixel : siggen_pixel_bars;
+   gen->context = context;
+   // The CPLD presents four 3-bit pixels or two 6-bit pixels on each psync edge
+   gen->pixels_per_sample = (timing->bpp == 6) ? 2 : 4;
+   gen->half_lines_per_field = 2 * timing->lines_per_frame + (timing->interlaced ? 1 : 0);
+   gen->rand = gen->impairments.seed ? gen->impairments.seed : 0x12345678;
+   siggen_new_line(gen);
+}
+
+int siggen_samples_per_field(siggen_t *gen) {
+   return gen->half_lines_per_field * (gen->timing.line_len >> 1) / gen->pixels_per_sample;
+}
+
+void siggen_next(siggen_t *gen, siggen_sample_t *sample) {
+   const siggen_timing_t *t = &gen->timing;
+   int half_len = t->line_len >> 1;
+   int bits = (t->bpp == 6) ? 6 : 3;
+   uint32_t mask = (1 << bits) - 1;
+   uint32_t value = 0;
+   int hsync = 0;
+   int vsync = 0;
+
+   // Even half lines (counting from the start of the first field) start a new line
+   int absolute_half_line = gen->field * gen->half_lines_per_field + gen->half_line;
+   int line_start = !(absolute_half_line & 1);
+
+   siggen_syncs(gen, gen->clock_in_line, line_start, &hsync, &vsync);
+
+   // Pixels
+   int x = gen->clock_in_line + (line_start ? 0 : half_len) - t->h_active_start;
+   int y = ((gen->half_line - (line_start ? 0 : 1)) >> 1) - t->v_active_start;
+   for (int i = 0; i < gen->pixels_per_sample; i++) {
+      if (x + i >= 0 && x + i < t->h_active && y >= 0 && y < t->v_active) {
+         value |= (gen->pixel(gen->context, x + i, y, gen->field & 1) & mask) << (PIXEL_BASE + i * bits);
+      }
+   }
+
+   // PSYNC toggles on every sample, a glitch loses an edge (shifting the phase of all following edges)
+   gen->psync ^= 1;
+   if (siggen_chance(gen, gen->impairments.glitch_rate)) {
+      gen->psync ^= 1;
+   }
+   if (gen->psync) {
+      value |= PSYNC_MASK;
+   }
+
+   // Sync is active low unless inverted
+   if (hsync == !!(t->sync_type & SYNC_BIT_HSYNC_INVERTED)) {
+      value |= CSYNC_MASK;
+   }
+
+   sample->gplev0 = value;
+   sample->vsync = (vsync == !!(t->sync_type & SYNC_BIT_VSYNC_INVERTED));
+   sample->time_ns = gen->time_ns;
+
+   // Advance to the next sample
+   gen->time_ns += (double)gen->pixels_per_sample * 1e9 / t->clock;
+   gen->clock_in_line += gen->pixels_per_sample;
+   if (gen->clock_in_line >= half_len) {
+      gen->clock_in_line -= half_len;
+      gen->half_line++;
+      if (gen->half_line >= gen->half_lines_per_field) {
+         gen->half_line = 0;
+         gen->field++;
+      }
+      absolute_half_line = gen->field * gen->half_lines_per_field + gen->half_line;
+      if (!(absolute_half_line & 1)) {
+         siggen_new_line(gen);
+      }
+   }
+}
+
+// Eight vertical colour bars
+int siggen_pixel_bars(void *context, int x, int y, int field) {
+   (void) context;
+   (void) y;
+   (void) field;
+   return (x * 8 / 640) & 7;
+}
+
+// One pixel checkerboard, alternate pixels differ so any phase error shows up
+int siggen_pixel_checker(void *context, int x, int y, int field) {
+   (void) context;
+   (void) field;
+   return ((x ^ y) & 1) ? 7 : 0;
+}
@@ -0,0 +1,81 @@
+#ifndef SIGGEN_H
+#define SIGGEN_H
+
+#include <inttypes.h>
+
+// =============================================================
+// Synthetic video signal generator
+// =============================================================
+//
+// Generates the sequence of GPLEV0 values that the CPLD would present
+// to the Pi for a given source timing, one value per psync edge.
+//
+// scripts/siggen_test.c checks the generated timings against the presets
+// by decoding the samples the way the capture code does.
+
+// Pixel source, returns the colour (3 or 6 bits) of pixel (x, y) in the active area
+typedef int (*siggen_pixel_fn)(void *context, int x, int y, int field);
+
+typedef struct {
+   const char *name;
+   int clock;            // sampling clock in Hz (as in the profile geometry)
+   int line_len;         // clocks per line
+   int lines_per_frame;  // lines per field
+   int sync_type;        // SYNC_BIT_* flags (polarity and composite)
+   int interlaced;       // if set, each field has an extra half line
+   int hsync_width;      // clocks
+   int vsync_lines;      // lines
+   int h_active_start;   // clocks from the leading edge of hsync to the first active pixel
+   int h_active;         // active clocks per line
+   int v_active_start;   // lines from the start of vsync to the first active line
+   int v_active;         // active lines per field
+   int bpp;              // bits per pixel presented by the CPLD (3 or 6)
+} siggen_timing_t;
+
+typedef struct {
+   int jitter_ns;        // peak random displacement of each hsync edge
+   int glitch_rate;      // chance of a psync glitch per sample (in 1/65536)
+   int dropout_rate;     // chance of a missing hsync pulse per line (in 1/65536)
+   uint32_t seed;        // seed for the random number generator
+} siggen_impairments_t;
+
+typedef struct {
+   uint32_t gplev0;      // value of GPLEV0 (pixels, psync and csync)
+   int vsync;            // level of the separate vsync signal (selected via the mux on real hardware)
+   double time_ns;       // time of the psync edge since the generator started
+} siggen_sample_t;
+
+typedef struct {
+   siggen_timing_t timing;
+   siggen_impairments_t impairments;
+   siggen_pixel_fn pixel;
+   void *context;
+   // Internal state
+   int pixels_per_sample;
+   int half_lines_per_field;
+   int field;
+   int half_line;        // half line within the current field
+   int clock_in_line;    // clock within the current half line
+   int line_offset;      // random displacement of the current line's hsync, in clocks
+   int line_dropped;     // current line's hsync is suppressed
+   int psync;
+   uint32_t rand;
+   double time_ns;
+} siggen_t;
+
+// Presets, terminated by an entry with a NULL name
+extern const siggen_timing_t siggen_presets[];
+
+const siggen_timing_t *siggen_find_preset(const char *name);
+
+void siggen_init(siggen_t *gen, const siggen_timing_t *timing, const siggen_impairments_t *impairments, siggen_pixel_fn pixel, void *context);
+
+void siggen_next(siggen_t *gen, siggen_sample_t *sample);
+
+int siggen_samples_per_field(siggen_t *gen);
+
+// Built in pixel sources
+int siggen_pixel_bars(void *context, int x, int y, int field);
+int siggen_pixel_checker(void *context, int x, int y, int field);
+
+#endif